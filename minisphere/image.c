@@ -7,11 +7,12 @@
 
 struct image
 {
-	int             refcount;
-	ALLEGRO_BITMAP* bitmap;
-	int             width;
-	int             height;
-	image_t*        parent;
+	int                    refcount;
+	ALLEGRO_BITMAP*        bitmap;
+	int                    width;
+	int                    height;
+	ALLEGRO_LOCKED_REGION* lock;
+	image_t*               parent;
 };
 
 static duk_ret_t js_GetSystemArrow           (duk_context* ctx);
@@ -147,25 +148,38 @@ on_error:
 image_t*
 read_subimage(FILE* file, image_t* parent, int x, int y, int width, int height)
 {
+	// if the parent image is locked (see lock_image()), pixels are written straight
+	// into the parent's lock; otherwise the subimage gets locked on its own.
+	
+	uint8_t*               data;
 	long                   file_pos;
 	image_t*               image;
 	uint8_t*               line_ptr;
 	size_t                 line_size;
 	ALLEGRO_LOCKED_REGION* lock = NULL;
+	int                    pitch;
 
 	int i_y;
 
 	file_pos = ftell(file);
 	if (!(image = create_subimage(parent, x, y, width, height))) goto on_error;
-	if ((lock = al_lock_bitmap(image->bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_WRITEONLY)) == NULL)
-		goto on_error;
+	if (parent->lock != NULL) {
+		pitch = parent->lock->pitch;
+		data = (uint8_t*)parent->lock->data + y * pitch + x * 4;
+	}
+	else {
+		if ((lock = al_lock_bitmap(image->bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_WRITEONLY)) == NULL)
+			goto on_error;
+		pitch = lock->pitch;
+		data = lock->data;
+	}
 	line_size = width * 4;
 	for (i_y = 0; i_y < height; ++i_y) {
-		line_ptr = (uint8_t*)lock->data + i_y * lock->pitch;
+		line_ptr = data + i_y * pitch;
 		if (fread(line_ptr, line_size, 1, file) != 1)
 			goto on_error;
 	}
-	al_unlock_bitmap(image->bitmap);
+	if (lock != NULL) al_unlock_bitmap(image->bitmap);
 	return image;
 
 on_error:
@@ -187,11 +201,33 @@ free_image(image_t* image)
 {
 	if (image == NULL || --image->refcount > 0)
 		return;
+	unlock_image(image);
 	al_destroy_bitmap(image->bitmap);
 	free_image(image->parent);
 	free(image);
 }
 
+bool
+lock_image(image_t* image)
+{
+	// locks an image for writing so that many subimages can be read into it under a
+	// single lock, e.g. when building an atlas.  the previous contents are discarded.
+	
+	if (image->lock != NULL)
+		return true;
+	image->lock = al_lock_bitmap(image->bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_WRITEONLY);
+	return image->lock != NULL;
+}
+
+void
+unlock_image(image_t* image)
+{
+	if (image->lock == NULL)
+		return;
+	al_unlock_bitmap(image->bitmap);
+	image->lock = NULL;
+}
+
 ALLEGRO_BITMAP*
 get_image_bitmap(const image_t* image)
 {
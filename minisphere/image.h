@@ -11,6 +11,8 @@ extern image_t*        read_image               (FILE* file, int width, int heig
 extern image_t*        read_subimage            (FILE* file, image_t* parent, int x, int y, int width, int height);
 extern image_t*        ref_image                (image_t* image);
 extern void            free_image               (image_t* image);
+extern bool            lock_image               (image_t* image);
+extern void            unlock_image             (image_t* image);
 extern ALLEGRO_BITMAP* get_image_bitmap         (const image_t* image);
 extern int             get_image_height         (const image_t* image);
 extern int             get_image_width          (const image_t* image);
@@ -21,13 +21,45 @@ enum map_script_type
 	MAP_SCRIPT_MAX
 };
 
+static const int CHUNK_SIZE      = 16;
+static const int MAX_TILE_CHUNKS = 128;
+static const int ZONE_CELL_SIZE  = 64;
+
 static map_t*              load_map            (const char* path);
+static map_t*              clone_map           (const map_t* template);
 static void                free_map            (map_t* map);
+static void                cache_map           (const char* path, map_t* map);
+static void                clear_map_cache     (void);
+static map_t*              find_cached_map     (const char* path);
+static void                finish_prefetch     (bool wait);
+static bool                start_prefetch      (char* path);
+static size_t              get_map_size        (const map_t* map);
+static void*               prefetch_map_thread (ALLEGRO_THREAD* thread, void* arg);
+static bool                is_delay_before     (int index_a, int index_b);
+static void                sift_delay_down     (int index);
+static void                sift_delay_up       (int index);
 static bool                are_zones_at        (int x, int y, int layer, int* out_count);
+static bool                build_trigger_index (map_t* map);
+static bool                build_zone_index    (map_t* map);
 static struct map_trigger* get_trigger_at      (int x, int y, int layer, int* out_index);
-static struct map_zone*    get_zone_at         (int x, int y, int layer, int which, int* out_index);
+static struct zone_cell*   get_zone_cell       (int x, int y);
+static int                 get_zones_at        (int x, int y, int layer, int* out_count);
+static bool                run_zones_at        (int x, int y, int layer, bool is_stepping);
+static duk_ret_t           run_zone_hits       (duk_context* ctx);
 static bool                change_map          (const char* filename, bool preserve_persons);
 static int                 find_layer          (const char* name);
+static bool                bake_chunk          (int layer, int chunk_x, int chunk_y);
+static void                draw_chunks         (int layer, int off_x, int off_y, bool is_repeating, bool bake_only);
+static void                free_chunks         (map_t* map, int layer);
+static void                draw_tile_window    (int layer, int off_x, int off_y, bool is_repeating);
+static void                free_tile_window    (map_t* map, int layer);
+static void                invalidate_cell     (int layer, int x, int y);
+static void                invalidate_tile     (int tile_index);
+static void                update_window_slot  (int layer, int cell_x, int cell_y);
+static uint8_t             get_walk_bits       (int layer, int x, int y);
+static bool                is_move_blocked     (int layer, int x, int y, int direction);
+static void                update_obs_bit      (map_t* map, int layer, int x, int y);
+static void                update_walk_cell    (int layer, int x, int y);
 static void                map_screen_to_layer (int layer, int camera_x, int camera_y, int* inout_x, int* inout_y);
 static void                process_map_input   (void);
 static void                render_map          (void);
@@ -102,6 +134,7 @@ static duk_ret_t js_ExecuteZones            (duk_context* ctx);
 static duk_ret_t js_ExitMapEngine           (duk_context* ctx);
 static duk_ret_t js_MapToScreenX            (duk_context* ctx);
 static duk_ret_t js_MapToScreenY            (duk_context* ctx);
+static duk_ret_t js_PrefetchMap             (duk_context* ctx);
 static duk_ret_t js_RenderMap               (duk_context* ctx);
 static duk_ret_t js_ReplaceTilesOnLayer     (duk_context* ctx);
 static duk_ret_t js_ScreenToMapX            (duk_context* ctx);
@@ -109,9 +142,10 @@ static duk_ret_t js_ScreenToMapY            (duk_context* ctx);
 static duk_ret_t js_SetDelayScript          (duk_context* ctx);
 static duk_ret_t js_UpdateMapEngine         (duk_context* ctx);
 
-static person_t*           s_camera_person     = NULL;
+static person_handle_t     s_camera_person     = 0;
 static int                 s_cam_x             = 0;
 static int                 s_cam_y             = 0;
+static unsigned int        s_chunk_clock       = 0;
 static color_t             s_color_mask;
 static color_t             s_fade_color_from;
 static color_t             s_fade_color_to;
@@ -125,24 +159,59 @@ static int                 s_def_scripts[MAP_SCRIPT_MAX];
 static bool                s_exiting           = false;
 static int                 s_framerate         = 0;
 static unsigned int        s_frames            = 0;
-static person_t*           s_input_person      = NULL;
+static person_handle_t     s_input_person      = 0;
+static bool                s_is_chunk_render   = false;
+static bool                s_is_mask_collision = false;
 static bool                s_is_talk_allowed   = true;
+static bool                s_is_trigger_layers = false;
 static bool                s_is_map_running    = false;
 static map_t*              s_map = NULL;
 static char*               s_map_filename      = NULL;
+static int                 s_num_chunks        = 0;
 static struct map_trigger* s_on_trigger        = NULL;
 static int                 s_render_script     = 0;
 static int                 s_talk_button       = 0;
 static int                 s_talk_key          = ALLEGRO_KEY_SPACE;
 static int                 s_update_script     = 0;
+static unsigned int        s_delay_clock       = 0;
+static unsigned int        s_delay_serial      = 0;
 static int                 s_num_delay_scripts = 0;
 static int                 s_max_delay_scripts = 0;
 static struct delay_script *s_delay_scripts    = NULL;
+static int                 s_num_zone_hits     = 0;
+static int                 s_max_zone_hits     = 0;
+static int                 *s_zone_hits        = NULL;
+static size_t              s_map_cache_budget  = 0;
+static unsigned int        s_map_cache_clock   = 0;
+static size_t              s_map_cache_size    = 0;
+static int                 s_num_cached_maps   = 0;
+static int                 s_max_cached_maps   = 0;
+static struct cached_map   *s_map_cache        = NULL;
+static struct map_prefetch *s_prefetch        = NULL;
+static ALLEGRO_MUTEX*      s_prefetch_mutex    = NULL;
+static char*               s_prefetch_next     = NULL;
+
+struct cached_map
+{
+	char*        path;
+	map_t*       map;
+	size_t       size;
+	unsigned int last_used;
+};
+
+struct map_prefetch
+{
+	char*           path;
+	bool            is_done;
+	map_t*          map;
+	ALLEGRO_THREAD* thread;
+};
 
 struct delay_script
 {
-	int script_id;
-	int frames_left;
+	int          script_id;
+	unsigned int due_frame;
+	unsigned int serial;
 };
 
 struct map
@@ -151,6 +220,7 @@ struct map
 	bool               is_repeating;
 	point3_t           origin;
 	int                scripts[MAP_SCRIPT_MAX];
+	lstring_t*         script_sources[MAP_SCRIPT_MAX];
 	tileset_t*         tileset;
 	int                num_layers;
 	int                num_persons;
@@ -160,23 +230,62 @@ struct map
 	struct map_person  *persons;
 	struct map_trigger *triggers;
 	struct map_zone    *zones;
+	int                trigger_hash_mask;
+	struct trigger_key *trigger_hash;
+	int                zone_grid_w, zone_grid_h;
+	struct zone_cell   *zone_cells;
+};
+
+struct tile_window
+{
+	bool               is_repeating;
+	bool               is_valid;
+	int                cols, rows;
+	int                x, y;
+	color_t            mask;
+	int                num_animated;
+	int                num_loose;
+	struct window_slot *slots;
+	ALLEGRO_VERTEX     *verts;
+};
+
+struct window_slot
+{
+	int  map_index;
+	int  frame;
+	bool is_animated;
+	bool is_loose;
 };
 
 struct map_layer
 {
-	lstring_t*       name;
-	bool             is_parallax;
-	bool             is_reflective;
-	bool             is_visible;
-	int              width, height;
-	float            autoscroll_x;
-	float            autoscroll_y;
-	float            parallax_x;
-	float            parallax_y;
-	struct map_tile* tilemap;
-	obsmap_t*        obsmap;
-	color_t          color_mask;
-	int              render_script;
+	lstring_t*         name;
+	bool               is_parallax;
+	bool               is_reflective;
+	bool               is_visible;
+	int                width, height;
+	float              autoscroll_x;
+	float              autoscroll_y;
+	float              parallax_x;
+	float              parallax_y;
+	struct map_tile*   tilemap;
+	obsmap_t*          obsmap;
+	color_t            color_mask;
+	int                render_script;
+	int                chunks_w, chunks_h;
+	struct tile_chunk* chunks;
+	struct tile_window window;
+	uint32_t*          obs_bits;
+	uint8_t*           walkmap;
+};
+
+struct tile_chunk
+{
+	ALLEGRO_BITMAP* bitmap;
+	unsigned int    last_used;
+	int             num_anim_cells;
+	int             max_anim_cells;
+	int             *anim_cells;
 };
 
 struct map_person
@@ -199,18 +308,35 @@ struct map_tile
 
 struct map_trigger
 {
-	int script_id;
-	int x, y, z;
+	lstring_t* script;
+	int        script_id;
+	int        x, y, z;
 };
 
 struct map_zone
 {
-	bool   is_active;
-	rect_t bounds;
-	int    step_interval;
-	int    steps_left;
-	int    layer;
-	int    script_id;
+	bool       is_active;
+	rect_t     bounds;
+	int        step_interval;
+	int        steps_left;
+	int        layer;
+	lstring_t* script;
+	int        script_id;
+};
+
+struct trigger_key
+{
+	bool is_used;
+	int  layer;
+	int  cell_x, cell_y;
+	int  index;
+};
+
+struct zone_cell
+{
+	int num_zones;
+	int max_zones;
+	int *zone_indices;
 };
 
 #pragma pack(push, 1)
@@ -273,18 +399,26 @@ initialize_map_engine(void)
 	initialize_persons_manager();
 	memset(s_def_scripts, 0, MAP_SCRIPT_MAX * sizeof(int));
 	s_map = NULL; s_map_filename = NULL;
-	s_input_person = s_camera_person = NULL;
+	s_input_person = s_camera_person = 0;
 	s_current_trigger = -1;
 	s_current_zone = -1;
 	s_render_script = 0;
 	s_update_script = 0;
 	s_num_delay_scripts = s_max_delay_scripts = 0;
+	s_num_zone_hits = s_max_zone_hits = 0;
 	s_delay_scripts = NULL;
+	s_delay_clock = s_delay_serial = 0;
 	s_talk_key = ALLEGRO_KEY_SPACE;
 	s_talk_button = 0;
 	s_is_map_running = false;
 	s_color_mask = rgba(0, 0, 0, 0);
 	s_on_trigger = NULL;
+	s_num_cached_maps = s_max_cached_maps = 0;
+	s_map_cache = NULL;
+	s_map_cache_size = s_map_cache_budget = 0;
+	s_prefetch = NULL;
+	s_prefetch_next = NULL;
+	s_prefetch_mutex = al_create_mutex();
 }
 
 void
@@ -294,7 +428,14 @@ shutdown_map_engine(void)
 
 	for (i = 0; i < s_num_delay_scripts; ++i) free_script(s_delay_scripts[i].script_id);
 	free(s_delay_scripts);
+	free(s_zone_hits);
+	s_zone_hits = NULL;
 	free_map(s_map);
+	free(s_prefetch_next);
+	s_prefetch_next = NULL;
+	finish_prefetch(true);
+	clear_map_cache();
+	al_destroy_mutex(s_prefetch_mutex);
 	shutdown_persons_manager();
 }
 
@@ -336,6 +477,43 @@ get_map_tile(int x, int y, int layer)
 	return s_map->layers[layer].tilemap[x + y * layer_w].tile_index;
 }
 
+bool
+is_map_tile_obstructive(int x, int y, int layer)
+{
+	// a single bit test, so collision checks can skip cells with no tile obstruction
+	// without looking up the tile's obstruction map
+	
+	int layer_h = s_map->layers[layer].height;
+	int layer_w = s_map->layers[layer].width;
+	int i;
+
+	x = (x % layer_w + layer_w) % layer_w;
+	y = (y % layer_h + layer_h) % layer_h;
+	i = x + y * layer_w;
+	return (s_map->layers[layer].obs_bits[i / 32] & (1u << (i % 32))) != 0;
+}
+
+bool
+test_map_tile_rect(int x, int y, int layer, rect_t rect)
+{
+	// tests a rectangle, given relative to the tile at (x, y), against that tile's
+	// obstructions.  games that set collision_mode=bitmask in game.sgm get the
+	// rasterized tile masks instead of the segment test.  the two don't agree
+	// exactly: the mask never misses a hit, but a diagonal segment rounds to pixels up
+	// to half a pixel off the true line, so a rect edge running right beside one can
+	// report a hit the segment test wouldn't.  segments lying along a rect edge also
+	// count as a hit here, where do_lines_intersect() sees parallel lines and says no.
+	
+	const obsmap_t* obsmap;
+	int             tile_index;
+
+	tile_index = get_map_tile(x, y, layer);
+	if (s_is_mask_collision)
+		return test_tile_mask(s_map->tileset, tile_index, rect);
+	obsmap = get_tile_obsmap(s_map->tileset, tile_index);
+	return obsmap != NULL && test_obsmap_rect(obsmap, rect);
+}
+
 const tileset_t*
 get_map_tileset(void)
 {
@@ -348,6 +526,32 @@ get_map_layer_obsmap(int layer)
 	return s_map->layers[layer].obsmap;
 }
 
+const uint8_t*
+get_map_walkmap(int layer, int* out_width, int* out_height, bool* out_is_repeating)
+{
+	// returns a layer's walkability grid: one byte per tile, where bit i is set if
+	// moving out of the cell toward neighbor i (0 = north, 1 = east, 2 = south,
+	// 3 = west) is blocked.  blocking is symmetric, so the neighbor has the opposite
+	// bit set too.  the grid is built on first use and kept up to date by SetTile() and
+	// ReplaceTilesOnLayer().
+	
+	struct map_layer* p_layer;
+
+	int x, y;
+
+	p_layer = &s_map->layers[layer];
+	if (p_layer->walkmap == NULL) {
+		if (!(p_layer->walkmap = malloc(p_layer->width * p_layer->height)))
+			return NULL;
+		for (y = 0; y < p_layer->height; ++y) for (x = 0; x < p_layer->width; ++x)
+			p_layer->walkmap[x + y * p_layer->width] = get_walk_bits(layer, x, y);
+	}
+	if (out_width) *out_width = p_layer->width;
+	if (out_height) *out_height = p_layer->height;
+	if (out_is_repeating) *out_is_repeating = s_map->is_repeating || p_layer->is_parallax;
+	return p_layer->walkmap;
+}
+
 void
 normalize_map_entity_xy(double* inout_x, double* inout_y, int layer)
 {
@@ -491,8 +695,7 @@ load_map(const char* path)
 				trigger->x = entity_hdr.x;
 				trigger->y = entity_hdr.y;
 				trigger->z = entity_hdr.z;
-				trigger->script_id = compile_script(script, "[trigger script]");
-				free_lstring(script);
+				trigger->script = script;
 				break;
 			default:
 				goto on_error;
@@ -507,8 +710,7 @@ load_map(const char* path)
 			map->zones[i].layer = zone_hdr.layer;
 			map->zones[i].bounds = new_rect(zone_hdr.x1, zone_hdr.y1, zone_hdr.x2, zone_hdr.y2);
 			map->zones[i].step_interval = zone_hdr.step_interval;
-			map->zones[i].script_id = compile_script(script, "[zone script]");
-			free_lstring(script);
+			map->zones[i].script = script;
 		}
 
 		// load tileset
@@ -516,14 +718,18 @@ load_map(const char* path)
 		tileset = strcmp(strings[0]->cstr, "") == 0 ? read_tileset(file) : load_tileset(tile_path);
 		free(tile_path);
 		if (tileset == NULL) goto on_error;
+		map->tileset = tileset;
 
-		// initialize tile animation
+		// initialize tile animation and obstruction bits
 		for (z = 0; z < rmp.num_layers; ++z) {
 			layer = &map->layers[z];
+			if (!(layer->obs_bits = calloc((layer->width * layer->height + 31) / 32, sizeof(uint32_t))))
+				goto on_error;
 			for (x = 0; x < layer->width; ++x) for (y = 0; y < layer->height; ++y) {
 				i = x + y * layer->width;
 				map->layers[z].tilemap[i].frames_left =
 					get_tile_delay(tileset, map->layers[z].tilemap[i].tile_index);
+				update_obs_bit(map, z, x, y);
 			}
 		}
 
@@ -534,16 +740,15 @@ load_map(const char* path)
 		map->origin.x = rmp.start_x;
 		map->origin.y = rmp.start_y;
 		map->origin.z = rmp.start_layer;
-		map->tileset = tileset;
 		if (rmp.num_strings >= 5) {
-			map->scripts[MAP_SCRIPT_ON_ENTER] = compile_script(strings[3], "[enter map script]");
-			map->scripts[MAP_SCRIPT_ON_LEAVE] = compile_script(strings[4], "[exit map script]");
+			map->script_sources[MAP_SCRIPT_ON_ENTER] = strings[3]; strings[3] = NULL;
+			map->script_sources[MAP_SCRIPT_ON_LEAVE] = strings[4]; strings[4] = NULL;
 		}
 		if (rmp.num_strings >= 9) {
-			map->scripts[MAP_SCRIPT_ON_LEAVE_NORTH] = compile_script(strings[5], "[leave map north script]");
-			map->scripts[MAP_SCRIPT_ON_LEAVE_EAST] = compile_script(strings[6], "[leave map east script]");
-			map->scripts[MAP_SCRIPT_ON_LEAVE_SOUTH] = compile_script(strings[7], "[leave map south script]");
-			map->scripts[MAP_SCRIPT_ON_LEAVE_WEST] = compile_script(strings[8], "[leave map west script]");
+			map->script_sources[MAP_SCRIPT_ON_LEAVE_NORTH] = strings[5]; strings[5] = NULL;
+			map->script_sources[MAP_SCRIPT_ON_LEAVE_EAST] = strings[6]; strings[6] = NULL;
+			map->script_sources[MAP_SCRIPT_ON_LEAVE_SOUTH] = strings[7]; strings[7] = NULL;
+			map->script_sources[MAP_SCRIPT_ON_LEAVE_WEST] = strings[8]; strings[8] = NULL;
 		}
 		for (i = 0; i < rmp.num_strings; ++i) free_lstring(strings[i]);
 		free(strings);
@@ -567,6 +772,7 @@ on_error:
 				free_lstring(map->layers[i].name);
 				free(map->layers[i].tilemap);
 				free_obsmap(map->layers[i].obsmap);
+				free(map->layers[i].obs_bits);
 			}
 			free(map->layers);
 		}
@@ -582,25 +788,128 @@ on_error:
 			}
 			free(map->persons);
 		}
-		free(map->triggers);
-		free(map->zones);
+		if (map->triggers != NULL) {
+			for (i = 0; i < map->num_triggers; ++i)
+				free_lstring(map->triggers[i].script);
+			free(map->triggers);
+		}
+		if (map->zones != NULL) {
+			for (i = 0; i < rmp.num_zones; ++i)
+				free_lstring(map->zones[i].script);
+			free(map->zones);
+		}
 		free(map);
 	}
 	return NULL;
 }
 
+static map_t*
+clone_map(const map_t* template)
+{
+	// maps are loaded from disk as templates with their scripts in source form so that
+	// loading doesn't touch the JS engine.  this creates a playable copy of a template,
+	// compiling its scripts.  everything the game can modify is copied; the tile images
+	// are shared with the template.
+	
+	struct map_layer*   layer;
+	map_t*              map = NULL;
+	struct map_person*  person;
+
+	int i;
+
+	if (!(map = calloc(1, sizeof(map_t)))) goto on_error;
+	map->width = template->width;
+	map->height = template->height;
+	map->is_repeating = template->is_repeating;
+	map->origin = template->origin;
+	if (!(map->layers = calloc(template->num_layers, sizeof(struct map_layer)))) goto on_error;
+	if (!(map->persons = calloc(template->num_persons, sizeof(struct map_person)))) goto on_error;
+	if (!(map->triggers = calloc(template->num_triggers, sizeof(struct map_trigger)))) goto on_error;
+	if (!(map->zones = calloc(template->num_zones, sizeof(struct map_zone)))) goto on_error;
+	if (!(map->tileset = clone_tileset(template->tileset))) goto on_error;
+	for (i = 0; i < template->num_layers; ++i) {
+		layer = &map->layers[i];
+		*layer = template->layers[i];
+		layer->name = NULL; layer->tilemap = NULL; layer->obsmap = NULL;
+		layer->obs_bits = NULL;
+		
+		// render caches belong to the map they were built for
+		layer->chunks = NULL; layer->chunks_w = layer->chunks_h = 0;
+		memset(&layer->window, 0, sizeof(struct tile_window));
+		layer->walkmap = NULL;
+		++map->num_layers;
+		if (!(layer->name = clone_lstring(template->layers[i].name))) goto on_error;
+		if (!(layer->obsmap = clone_obsmap(template->layers[i].obsmap))) goto on_error;
+		if (!(layer->tilemap = malloc(layer->width * layer->height * sizeof(struct map_tile))))
+			goto on_error;
+		memcpy(layer->tilemap, template->layers[i].tilemap, layer->width * layer->height * sizeof(struct map_tile));
+		if (!(layer->obs_bits = malloc((layer->width * layer->height + 31) / 32 * sizeof(uint32_t))))
+			goto on_error;
+		memcpy(layer->obs_bits, template->layers[i].obs_bits, (layer->width * layer->height + 31) / 32 * sizeof(uint32_t));
+	}
+	for (i = 0; i < template->num_persons; ++i) {
+		person = &map->persons[i];
+		++map->num_persons;
+		person->x = template->persons[i].x;
+		person->y = template->persons[i].y;
+		person->z = template->persons[i].z;
+		if (!(person->name = clone_lstring(template->persons[i].name))) goto on_error;
+		if (!(person->spriteset = clone_lstring(template->persons[i].spriteset))) goto on_error;
+		if (!(person->create_script = clone_lstring(template->persons[i].create_script))) goto on_error;
+		if (!(person->destroy_script = clone_lstring(template->persons[i].destroy_script))) goto on_error;
+		if (!(person->command_script = clone_lstring(template->persons[i].command_script))) goto on_error;
+		if (!(person->talk_script = clone_lstring(template->persons[i].talk_script))) goto on_error;
+		if (!(person->touch_script = clone_lstring(template->persons[i].touch_script))) goto on_error;
+	}
+	for (i = 0; i < template->num_triggers; ++i) {
+		map->triggers[i] = template->triggers[i];
+		map->triggers[i].script = NULL;
+		map->triggers[i].script_id = defer_script(template->triggers[i].script, "[trigger script]");
+		++map->num_triggers;
+	}
+	for (i = 0; i < template->num_zones; ++i) {
+		map->zones[i] = template->zones[i];
+		map->zones[i].script = NULL;
+		map->zones[i].script_id = defer_script(template->zones[i].script, "[zone script]");
+		++map->num_zones;
+	}
+	if (template->script_sources[MAP_SCRIPT_ON_ENTER] != NULL) {
+		map->scripts[MAP_SCRIPT_ON_ENTER] = defer_script(template->script_sources[MAP_SCRIPT_ON_ENTER], "[enter map script]");
+		map->scripts[MAP_SCRIPT_ON_LEAVE] = defer_script(template->script_sources[MAP_SCRIPT_ON_LEAVE], "[exit map script]");
+	}
+	if (template->script_sources[MAP_SCRIPT_ON_LEAVE_NORTH] != NULL) {
+		map->scripts[MAP_SCRIPT_ON_LEAVE_NORTH] = defer_script(template->script_sources[MAP_SCRIPT_ON_LEAVE_NORTH], "[leave map north script]");
+		map->scripts[MAP_SCRIPT_ON_LEAVE_EAST] = defer_script(template->script_sources[MAP_SCRIPT_ON_LEAVE_EAST], "[leave map east script]");
+		map->scripts[MAP_SCRIPT_ON_LEAVE_SOUTH] = defer_script(template->script_sources[MAP_SCRIPT_ON_LEAVE_SOUTH], "[leave map south script]");
+		map->scripts[MAP_SCRIPT_ON_LEAVE_WEST] = defer_script(template->script_sources[MAP_SCRIPT_ON_LEAVE_WEST], "[leave map west script]");
+	}
+	if (!build_trigger_index(map)) goto on_error;
+	if (!build_zone_index(map)) goto on_error;
+	return map;
+
+on_error:
+	free_map(map);
+	return NULL;
+}
+
 static void
 free_map(map_t* map)
 {
 	int i;
 
 	if (map != NULL) {
-		for (i = 0; i < MAP_SCRIPT_MAX; ++i)
+		for (i = 0; i < MAP_SCRIPT_MAX; ++i) {
 			free_script(map->scripts[i]);
+			free_lstring(map->script_sources[i]);
+		}
 		for (i = 0; i < map->num_layers; ++i) {
 			free_lstring(map->layers[i].name);
 			free(map->layers[i].tilemap);
 			free_obsmap(map->layers[i].obsmap);
+			free_chunks(map, i);
+			free_tile_window(map, i);
+			free(map->layers[i].obs_bits);
+			free(map->layers[i].walkmap);
 		}
 		for (i = 0; i < map->num_persons; ++i) {
 			free_lstring(map->persons[i].name);
@@ -611,88 +920,472 @@ free_map(map_t* map)
 			free_lstring(map->persons[i].talk_script);
 			free_lstring(map->persons[i].touch_script);
 		}
-		for (i = 0; i < map->num_triggers; ++i)
+		for (i = 0; i < map->num_triggers; ++i) {
 			free_script(map->triggers[i].script_id);
-		for (i = 0; i < map->num_zones; ++i)
+			free_lstring(map->triggers[i].script);
+		}
+		for (i = 0; i < map->num_zones; ++i) {
 			free_script(map->zones[i].script_id);
-		free_tileset(map->tileset);
+			free_lstring(map->zones[i].script);
+		}
+		for (i = 0; i < map->zone_grid_w * map->zone_grid_h; ++i)
+			free(map->zone_cells[i].zone_indices);
+		if (map->tileset != NULL)
+			free_tileset(map->tileset);
 		free(map->layers);
 		free(map->persons);
 		free(map->triggers);
+		free(map->trigger_hash);
+		free(map->zones);
+		free(map->zone_cells);
 		free(map);
 	}
 }
 
+static void
+cache_map(const char* path, map_t* map)
+{
+	// adds a map template to the cache, evicting the least recently used maps to stay
+	// within budget.  the newest map is always kept, even if it's over budget by itself,
+	// so that PrefetchMap() still works with a small cache.
+	
+	struct cached_map* entry;
+	int                lru_index;
+	struct cached_map* new_cache;
+	int                new_size;
+	const char*        value;
+	
+	int i;
+
+	// game.sgm isn't loaded yet when the map engine is initialized, and PrefetchMap()
+	// can be called before MapEngine(), so the budget is read on first use
+	if (s_map_cache_budget == 0) {
+		value = al_get_config_value(g_game_conf, NULL, "map_cache_mb");
+		s_map_cache_budget = (value != NULL ? atoi(value) : 16) * 1048576;
+	}
+	if (s_num_cached_maps >= s_max_cached_maps) {
+		new_size = (s_num_cached_maps + 1) * 2;
+		if (!(new_cache = realloc(s_map_cache, new_size * sizeof(struct cached_map)))) {
+			free_map(map);
+			return;
+		}
+		s_map_cache = new_cache;
+		s_max_cached_maps = new_size;
+	}
+	entry = &s_map_cache[s_num_cached_maps++];
+	entry->path = strdup(path);
+	entry->map = map;
+	entry->size = get_map_size(map);
+	entry->last_used = ++s_map_cache_clock;
+	s_map_cache_size += entry->size;
+	while (s_map_cache_size > s_map_cache_budget && s_num_cached_maps > 1) {
+		lru_index = 0;
+		for (i = 1; i < s_num_cached_maps; ++i) {
+			if (s_map_cache[i].last_used < s_map_cache[lru_index].last_used)
+				lru_index = i;
+		}
+		entry = &s_map_cache[lru_index];
+		s_map_cache_size -= entry->size;
+		free(entry->path);
+		free_map(entry->map);
+		s_map_cache[lru_index] = s_map_cache[--s_num_cached_maps];
+	}
+}
+
+static void
+clear_map_cache(void)
+{
+	int i;
+
+	for (i = 0; i < s_num_cached_maps; ++i) {
+		free(s_map_cache[i].path);
+		free_map(s_map_cache[i].map);
+	}
+	free(s_map_cache);
+	s_map_cache = NULL;
+	s_num_cached_maps = s_max_cached_maps = 0;
+	s_map_cache_size = 0;
+}
+
+static map_t*
+find_cached_map(const char* path)
+{
+	int i;
+
+	for (i = 0; i < s_num_cached_maps; ++i) {
+		if (strcmp(s_map_cache[i].path, path) == 0) {
+			s_map_cache[i].last_used = ++s_map_cache_clock;
+			return s_map_cache[i].map;
+		}
+	}
+	return NULL;
+}
+
+static void
+finish_prefetch(bool wait)
+{
+	// collects a map loaded by PrefetchMap() and moves it into the cache.  the tileset
+	// is loaded into memory bitmaps on the loader thread, so it's uploaded here.  if
+	// another map was requested in the meantime, its load is started next.
+	
+	bool  is_done;
+	char* path;
+
+	if (s_prefetch == NULL)
+		return;
+	if (!wait) {
+		al_lock_mutex(s_prefetch_mutex);
+		is_done = s_prefetch->is_done;
+		al_unlock_mutex(s_prefetch_mutex);
+		if (!is_done) return;
+	}
+	al_join_thread(s_prefetch->thread, NULL);
+	al_destroy_thread(s_prefetch->thread);
+	if (s_prefetch->map != NULL) {
+		if (upload_tileset(s_prefetch->map->tileset))
+			cache_map(s_prefetch->path, s_prefetch->map);
+		else
+			free_map(s_prefetch->map);
+	}
+	free(s_prefetch->path);
+	free(s_prefetch);
+	s_prefetch = NULL;
+	if ((path = s_prefetch_next) != NULL) {
+		s_prefetch_next = NULL;
+		if (find_cached_map(path) == NULL)
+			start_prefetch(path);  // nobody to report a failure to at this point
+		else
+			free(path);
+	}
+}
+
+static bool
+start_prefetch(char* path)
+{
+	// starts loading a map on a background thread.  takes ownership of path, which is
+	// freed if the load can't be started.
+	
+	if (!(s_prefetch = calloc(1, sizeof(struct map_prefetch)))) {
+		free(path);
+		return false;
+	}
+	s_prefetch->path = path;
+	if (!(s_prefetch->thread = al_create_thread(prefetch_map_thread, s_prefetch))) {
+		free(s_prefetch->path);
+		free(s_prefetch);
+		s_prefetch = NULL;
+		return false;
+	}
+	al_start_thread(s_prefetch->thread);
+	return true;
+}
+
+static size_t
+get_map_size(const map_t* map)
+{
+	image_t* atlas;
+	size_t   size;
+
+	int i;
+
+	atlas = get_tile_atlas(map->tileset);
+	size = get_image_width(atlas) * get_image_height(atlas) * 4;
+	for (i = 0; i < map->num_layers; ++i)
+		size += map->layers[i].width * map->layers[i].height * sizeof(struct map_tile)
+			+ (map->layers[i].width * map->layers[i].height + 31) / 32 * sizeof(uint32_t);
+	return size;
+}
+
+static void*
+prefetch_map_thread(ALLEGRO_THREAD* thread, void* arg)
+{
+	// runs load_map() on a background thread.  load_map() doesn't touch the JS engine or
+	// the display; get_asset_path() only reads from g_game_path.
+	
+	struct map_prefetch* prefetch = arg;
+	map_t*               map;
+
+	map = load_map(prefetch->path);
+	al_lock_mutex(s_prefetch_mutex);
+	prefetch->map = map;
+	prefetch->is_done = true;
+	al_unlock_mutex(s_prefetch_mutex);
+	return NULL;
+}
+
 static bool
 are_zones_at(int x, int y, int layer, int* out_count)
 {
-	int              count = 0;
-	struct map_zone* zone;
-	bool             zone_found;
+	struct zone_cell* cell;
+	int               count = 0;
+	struct map_zone*  zone;
 
 	int i;
 
-	zone_found = false;
-	for (i = 0; i < s_map->num_zones; ++i) {
-		zone = &s_map->zones[i];
-		if (zone->layer != layer && false)  // layer ignored for compatibility
-			continue;
-		if (is_point_in_rect(x, y, zone->bounds)) {
-			zone_found = true;
-			++count;
+	if (cell = get_zone_cell(x, y)) {
+		for (i = 0; i < cell->num_zones; ++i) {
+			zone = &s_map->zones[cell->zone_indices[i]];
+			if (zone->layer != layer && false)  // layer ignored for compatibility
+				continue;
+			if (is_point_in_rect(x, y, zone->bounds))
+				++count;
 		}
 	}
 	if (out_count) *out_count = count;
-	return zone_found;
+	return count > 0;
+}
+
+static int
+floor_div(int a, int b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static unsigned int
+hash_trigger_cell(int layer, int cell_x, int cell_y)
+{
+	return (unsigned int)cell_x * 73856093U
+		^ (unsigned int)cell_y * 19349663U
+		^ (unsigned int)layer * 83492791U;
+}
+
+static bool
+build_trigger_index(map_t* map)
+{
+	// triggers are hashed by (layer, tile cell).  a trigger's activation area is one tile
+	// centered on its location, so it can overlap at most 4 tile cells.  unless the game
+	// opts in through game.sgm, all triggers share layer 0 for Sphere compatibility.
+	struct trigger_key* key;
+	int                 layer;
+	int                 num_keys;
+	unsigned int        slot;
+	int                 tile_w, tile_h;
+	struct map_trigger* trigger;
+	int                 x1, y1;
+
+	int i, x, y;
+
+	get_tile_size(map->tileset, &tile_w, &tile_h);
+	num_keys = 8;
+	while (num_keys < map->num_triggers * 8)
+		num_keys *= 2;
+	if (!(map->trigger_hash = calloc(num_keys, sizeof(struct trigger_key))))
+		return false;
+	map->trigger_hash_mask = num_keys - 1;
+	for (i = 0; i < map->num_triggers; ++i) {
+		trigger = &map->triggers[i];
+		layer = s_is_trigger_layers ? trigger->z : 0;
+		x1 = trigger->x - tile_w / 2;
+		y1 = trigger->y - tile_h / 2;
+		for (y = floor_div(y1, tile_h); y <= floor_div(y1 + tile_h - 1, tile_h); ++y)
+		for (x = floor_div(x1, tile_w); x <= floor_div(x1 + tile_w - 1, tile_w); ++x) {
+			slot = hash_trigger_cell(layer, x, y) & map->trigger_hash_mask;
+			while (map->trigger_hash[slot].is_used)
+				slot = (slot + 1) & map->trigger_hash_mask;
+			key = &map->trigger_hash[slot];
+			key->is_used = true;
+			key->layer = layer;
+			key->cell_x = x; key->cell_y = y;
+			key->index = i;
+		}
+	}
+	return true;
+}
+
+static bool
+build_zone_index(map_t* map)
+{
+	// zones are bucketed into a uniform grid of ZONE_CELL_SIZE pixel cells covering
+	// every zone's bounds.  any point outside the grid can't be inside a zone.
+	struct zone_cell* cell;
+	int*              new_list;
+	int               new_size;
+	rect_t            span;
+	struct map_zone*  zone;
+
+	int i, x, y;
+
+	map->zone_grid_w = map->zone_grid_h = 0;
+	for (i = 0; i < map->num_zones; ++i) {
+		zone = &map->zones[i];
+		map->zone_grid_w = fmax(map->zone_grid_w, (zone->bounds.x2 + ZONE_CELL_SIZE - 1) / ZONE_CELL_SIZE);
+		map->zone_grid_h = fmax(map->zone_grid_h, (zone->bounds.y2 + ZONE_CELL_SIZE - 1) / ZONE_CELL_SIZE);
+	}
+	if (map->zone_grid_w == 0 || map->zone_grid_h == 0) {
+		map->zone_grid_w = map->zone_grid_h = 0;
+		return true;
+	}
+	if (!(map->zone_cells = calloc(map->zone_grid_w * map->zone_grid_h, sizeof(struct zone_cell))))
+		return false;
+	for (i = 0; i < map->num_zones; ++i) {
+		zone = &map->zones[i];
+		if (zone->bounds.x2 <= zone->bounds.x1 || zone->bounds.y2 <= zone->bounds.y1)
+			continue;  // zone is empty and can never be entered
+		span.x1 = zone->bounds.x1 / ZONE_CELL_SIZE;
+		span.y1 = zone->bounds.y1 / ZONE_CELL_SIZE;
+		span.x2 = (zone->bounds.x2 - 1) / ZONE_CELL_SIZE;
+		span.y2 = (zone->bounds.y2 - 1) / ZONE_CELL_SIZE;
+		for (y = span.y1; y <= span.y2; ++y) for (x = span.x1; x <= span.x2; ++x) {
+			cell = &map->zone_cells[x + y * map->zone_grid_w];
+			if (cell->num_zones + 1 > cell->max_zones) {
+				new_size = (cell->num_zones + 1) * 2;
+				if (!(new_list = realloc(cell->zone_indices, new_size * sizeof(int))))
+					return false;
+				cell->zone_indices = new_list;
+				cell->max_zones = new_size;
+			}
+			cell->zone_indices[cell->num_zones++] = i;
+		}
+	}
+	return true;
 }
 
 static struct map_trigger*
 get_trigger_at(int x, int y, int layer, int* out_index)
 {
 	rect_t              bounds;
-	struct map_trigger* found_item = NULL;
+	int                 cell_x, cell_y;
+	int                 found_index = -1;
+	struct trigger_key* key;
+	unsigned int        slot;
 	int                 tile_w, tile_h;
 	struct map_trigger* trigger;
 
-	int i;
-
 	get_tile_size(s_map->tileset, &tile_w, &tile_h);
-	for (i = 0; i < s_map->num_triggers; ++i) {
-		trigger = &s_map->triggers[i];
-		if (trigger->z != layer && false)  // layer ignored for compatibility reasons
+	cell_x = floor_div(x, tile_w);
+	cell_y = floor_div(y, tile_h);
+	if (!s_is_trigger_layers)  // layer ignored for compatibility reasons
+		layer = 0;
+
+	// more than one trigger can overlap a cell; the first in map order wins
+	slot = hash_trigger_cell(layer, cell_x, cell_y) & s_map->trigger_hash_mask;
+	for (; s_map->trigger_hash[slot].is_used; slot = (slot + 1) & s_map->trigger_hash_mask) {
+		key = &s_map->trigger_hash[slot];
+		if (key->layer != layer || key->cell_x != cell_x || key->cell_y != cell_y)
 			continue;
+		if (found_index >= 0 && key->index > found_index)
+			continue;
+		trigger = &s_map->triggers[key->index];
 		bounds.x1 = trigger->x - tile_w / 2;
 		bounds.y1 = trigger->y - tile_h / 2;
 		bounds.x2 = bounds.x1 + tile_w;
 		bounds.y2 = bounds.y1 + tile_h;
-		if (is_point_in_rect(x, y, bounds)) {
-			found_item = trigger;
-			if (out_index) *out_index = i;
-			break;
-		}
+		if (is_point_in_rect(x, y, bounds))
+			found_index = key->index;
 	}
-	return found_item;
+	if (found_index < 0)
+		return NULL;
+	if (out_index) *out_index = found_index;
+	return &s_map->triggers[found_index];
 }
 
-static struct map_zone*
-get_zone_at(int x, int y, int layer, int which, int* out_index)
+static struct zone_cell*
+get_zone_cell(int x, int y)
 {
-	struct map_zone* found_item = NULL;
-	struct map_zone* zone;
+	int cell_x, cell_y;
+	
+	if (x < 0 || y < 0) return NULL;
+	cell_x = x / ZONE_CELL_SIZE;
+	cell_y = y / ZONE_CELL_SIZE;
+	if (cell_x >= s_map->zone_grid_w || cell_y >= s_map->zone_grid_h)
+		return NULL;
+	return &s_map->zone_cells[cell_x + cell_y * s_map->zone_grid_w];
+}
+
+static int
+get_zones_at(int x, int y, int layer, int* out_count)
+{
+	// pushes the indices of all zones containing (x,y), in map order, onto the zone hit
+	// stack and returns where they start.  the caller reads them as s_zone_hits[base + i]
+	// and pops them afterwards by setting s_num_zone_hits back to base.  zone scripts can
+	// call ExecuteZones() or UpdateMapEngine(), so nested lookups stack on top of each
+	// other; once the stack has grown, a step through a zone doesn't allocate.  returns
+	// -1 if the stack couldn't be grown.
+	
+	struct zone_cell* cell;
+	int               base;
+	int*              new_hits;
+	int               new_size;
+	struct map_zone*  zone;
 	
 	int i;
 
-	for (i = 0; i < s_map->num_zones; ++i) {
-		zone = &s_map->zones[i];
+	*out_count = 0;
+	base = s_num_zone_hits;
+	if ((cell = get_zone_cell(x, y)) == NULL || cell->num_zones == 0)
+		return base;
+	if (base + cell->num_zones > s_max_zone_hits) {
+		new_size = (base + cell->num_zones) * 2;
+		if (!(new_hits = realloc(s_zone_hits, new_size * sizeof(int))))
+			return -1;
+		s_zone_hits = new_hits;
+		s_max_zone_hits = new_size;
+	}
+	for (i = 0; i < cell->num_zones; ++i) {
+		zone = &s_map->zones[cell->zone_indices[i]];
 		if (zone->layer != layer && false)  // layer ignored for compatibility
 			continue;
-		if (is_point_in_rect(x, y, zone->bounds) && which-- == 0) {
-			found_item = zone;
-			if (out_index) *out_index = i;
-			break;
-		}
+		if (is_point_in_rect(x, y, zone->bounds))
+			s_zone_hits[s_num_zone_hits++] = cell->zone_indices[i];
+	}
+	*out_count = s_num_zone_hits - base;
+	return base;
+}
+
+static bool
+run_zones_at(int x, int y, int layer, bool is_stepping)
+{
+	// runs the scripts of all zones containing (x,y).  when is_stepping is true, each
+	// zone only fires once its step interval runs out.  the scripts are run through
+	// duk_safe_call() so that the zone hits are popped even if one of them throws; the
+	// error is then passed on to the caller.  returns false if the hits couldn't be
+	// collected.
+	
+	int last_zone;
+	int num_zones;
+	int result;
+	int zone_base;
+
+	if ((zone_base = get_zones_at(x, y, layer, &num_zones)) < 0)
+		return false;
+	if (num_zones == 0)
+		return true;
+	last_zone = s_current_zone;
+	duk_push_int(g_duktape, zone_base);
+	duk_push_int(g_duktape, num_zones);
+	duk_push_boolean(g_duktape, is_stepping);
+	result = duk_safe_call(g_duktape, run_zone_hits, 3, 1);
+	s_current_zone = last_zone;
+	s_num_zone_hits = zone_base;
+	if (result != DUK_EXEC_SUCCESS)
+		duk_throw(g_duktape);
+	duk_pop(g_duktape);
+	return true;
+}
+
+static duk_ret_t
+run_zone_hits(duk_context* ctx)
+{
+	int zone_base = duk_require_int(ctx, 0);
+	int num_zones = duk_require_int(ctx, 1);
+	bool is_stepping = duk_require_boolean(ctx, 2);
+	
+	map_t*           map;
+	struct map_zone* zone;
+
+	int i;
+
+	// a zone script may change maps, in which case the rest of the hits are stale
+	map = s_map;
+	for (i = 0; i < num_zones && s_map == map; ++i) {
+		zone = &s_map->zones[s_zone_hits[zone_base + i]];
+		if (is_stepping && zone->steps_left-- > 0)
+			continue;
+		s_current_zone = s_zone_hits[zone_base + i];
+		zone->steps_left = zone->step_interval;
+		run_script(zone->script_id, true);
 	}
-	return found_item;
+	return 0;
 }
 
 static bool
@@ -702,11 +1395,29 @@ change_map(const char* filename, bool preserve_persons)
 	char*              path;
 	person_t*          person;
 	struct map_person* person_info;
+	map_t*             template;
 
 	int i;
 
+	// use the cached copy of the map if there is one, otherwise load it from disk.  if
+	// a prefetch is pending for it, wait for that instead.
 	path = get_asset_path(filename, "maps", false);
-	map = load_map(path);
+	if (s_prefetch != NULL && strcmp(path, s_prefetch->path) == 0)
+		finish_prefetch(true);
+	if (s_prefetch_next != NULL && strcmp(path, s_prefetch_next) == 0) {
+		free(s_prefetch_next);
+		s_prefetch_next = NULL;
+	}
+	if ((template = find_cached_map(path)) != NULL)
+		map = clone_map(template);
+	else {
+		if ((template = load_map(path)) == NULL) {
+			free(path);
+			return false;
+		}
+		map = clone_map(template);
+		cache_map(path, template);
+	}
 	free(path);
 	if (map == NULL) return false;
 	if (s_map != NULL) {
@@ -721,13 +1432,14 @@ change_map(const char* filename, bool preserve_persons)
 	// populate persons
 	for (i = 0; i < s_map->num_persons; ++i) {
 		person_info = &s_map->persons[i];
-		person = create_person(person_info->name->cstr, person_info->spriteset->cstr, false);
+		if (!(person = create_person(person_info->name->cstr, person_info->spriteset->cstr, false)))
+			return false;
 		set_person_xyz(person, person_info->x, person_info->y, person_info->z);
-		set_person_script(person, PERSON_SCRIPT_ON_CREATE, person_info->create_script);
-		set_person_script(person, PERSON_SCRIPT_ON_DESTROY, person_info->destroy_script);
-		set_person_script(person, PERSON_SCRIPT_ON_TOUCH, person_info->touch_script);
-		set_person_script(person, PERSON_SCRIPT_ON_TALK, person_info->talk_script);
-		set_person_script(person, PERSON_SCRIPT_GENERATOR, person_info->command_script);
+		set_person_script(person, PERSON_SCRIPT_ON_CREATE, person_info->create_script, true);
+		set_person_script(person, PERSON_SCRIPT_ON_DESTROY, person_info->destroy_script, true);
+		set_person_script(person, PERSON_SCRIPT_ON_TOUCH, person_info->touch_script, true);
+		set_person_script(person, PERSON_SCRIPT_ON_TALK, person_info->talk_script, true);
+		set_person_script(person, PERSON_SCRIPT_GENERATOR, person_info->command_script, true);
 		call_person_script(person, PERSON_SCRIPT_ON_CREATE, true);
 	}
 
@@ -755,6 +1467,526 @@ find_layer(const char* name)
 	return -1;
 }
 
+static bool
+bake_chunk(int layer_index, int chunk_x, int chunk_y)
+{
+	// pre-renders the static tiles in a chunk to a bitmap.  tiles which are animated are
+	// left out and their locations recorded so they can be drawn on top every frame.
+	
+	struct tile_chunk* chunk;
+	struct tile_chunk* evictee;
+	struct map_layer*  layer;
+	int*               new_list;
+	int                new_size;
+	ALLEGRO_STATE      old_state;
+	int                tile_index;
+	int                tile_w, tile_h;
+	int                x1, y1, x2, y2;
+
+	int i, x, y, z;
+
+	layer = &s_map->layers[layer_index];
+	chunk = &layer->chunks[chunk_x + chunk_y * layer->chunks_w];
+	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	x1 = chunk_x * CHUNK_SIZE; x2 = fmin(x1 + CHUNK_SIZE, layer->width);
+	y1 = chunk_y * CHUNK_SIZE; y2 = fmin(y1 + CHUNK_SIZE, layer->height);
+	
+	// if we're at the limit, evict the least recently drawn chunk.  chunks drawn this
+	// frame are never evicted, so the cache may briefly go over its limit.
+	if (s_num_chunks >= MAX_TILE_CHUNKS) {
+		evictee = NULL;
+		for (z = 0; z < s_map->num_layers; ++z) for (i = 0; i < s_map->layers[z].chunks_w * s_map->layers[z].chunks_h; ++i) {
+			if (s_map->layers[z].chunks[i].bitmap == NULL || s_map->layers[z].chunks[i].last_used == s_chunk_clock)
+				continue;
+			if (evictee == NULL || s_map->layers[z].chunks[i].last_used < evictee->last_used)
+				evictee = &s_map->layers[z].chunks[i];
+		}
+		if (evictee != NULL) {
+			al_destroy_bitmap(evictee->bitmap);
+			evictee->bitmap = NULL;
+			--s_num_chunks;
+		}
+	}
+	if (!(chunk->bitmap = al_create_bitmap((x2 - x1) * tile_w, (y2 - y1) * tile_h)))
+		return false;
+	++s_num_chunks;
+	chunk->num_anim_cells = 0;
+	al_store_state(&old_state, ALLEGRO_STATE_TARGET_BITMAP | ALLEGRO_STATE_BLENDER);
+	al_set_target_bitmap(chunk->bitmap);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_ZERO);
+	al_hold_bitmap_drawing(true);
+	for (y = y1; y < y2; ++y) for (x = x1; x < x2; ++x) {
+		tile_index = layer->tilemap[x + y * layer->width].tile_index;
+		if (is_tile_animated(s_map->tileset, tile_index)) {
+			if (chunk->num_anim_cells >= chunk->max_anim_cells) {
+				new_size = (chunk->num_anim_cells + 1) * 2;
+				if (!(new_list = realloc(chunk->anim_cells, new_size * sizeof(int))))
+					goto on_error;
+				chunk->anim_cells = new_list;
+				chunk->max_anim_cells = new_size;
+			}
+			chunk->anim_cells[chunk->num_anim_cells++] = x + y * layer->width;
+		}
+		else {
+			draw_tile(s_map->tileset, rgba(255, 255, 255, 255), (x - x1) * tile_w, (y - y1) * tile_h, tile_index);
+		}
+	}
+	al_hold_bitmap_drawing(false);
+	al_restore_state(&old_state);
+	return true;
+
+on_error:
+	al_hold_bitmap_drawing(false);
+	al_restore_state(&old_state);
+	al_destroy_bitmap(chunk->bitmap);
+	chunk->bitmap = NULL;
+	--s_num_chunks;
+	return false;
+}
+
+static void
+draw_chunks(int layer_index, int off_x, int off_y, bool is_repeating, bool bake_only)
+{
+	int                cell_x, cell_y;
+	struct tile_chunk* chunk;
+	int                chunk_pw, chunk_ph;
+	int                copy_x1, copy_y1, copy_x2, copy_y2;
+	struct map_layer*  layer;
+	int                layer_w, layer_h;
+	ALLEGRO_COLOR      mask;
+	int                tile_w, tile_h;
+	int                x, y;
+	int                x1, y1, x2, y2;
+	int                x_base, y_base;
+	
+	int cx, cy, i, ix, iy;
+
+	layer = &s_map->layers[layer_index];
+	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	if (layer->chunks == NULL) {
+		layer->chunks_w = (layer->width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		layer->chunks_h = (layer->height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		if (!(layer->chunks = calloc(layer->chunks_w * layer->chunks_h, sizeof(struct tile_chunk))))
+			return;
+	}
+	layer_w = layer->width * tile_w;
+	layer_h = layer->height * tile_h;
+	chunk_pw = CHUNK_SIZE * tile_w;
+	chunk_ph = CHUNK_SIZE * tile_h;
+	mask = al_map_rgba(layer->color_mask.r, layer->color_mask.g, layer->color_mask.b, layer->color_mask.alpha);
+	
+	// repeating layers are drawn as a grid of copies; only the chunks of each copy which
+	// actually overlap the screen are visited.
+	copy_x1 = is_repeating ? floor_div(off_x, layer_w) : 0;
+	copy_y1 = is_repeating ? floor_div(off_y, layer_h) : 0;
+	copy_x2 = is_repeating ? floor_div(off_x + g_res_x - 1, layer_w) : 0;
+	copy_y2 = is_repeating ? floor_div(off_y + g_res_y - 1, layer_h) : 0;
+	for (iy = copy_y1; iy <= copy_y2; ++iy) for (ix = copy_x1; ix <= copy_x2; ++ix) {
+		x_base = ix * layer_w - off_x;
+		y_base = iy * layer_h - off_y;
+		x1 = fmax(floor_div(-x_base, chunk_pw), 0);
+		y1 = fmax(floor_div(-y_base, chunk_ph), 0);
+		x2 = fmin(floor_div(g_res_x - 1 - x_base, chunk_pw), layer->chunks_w - 1);
+		y2 = fmin(floor_div(g_res_y - 1 - y_base, chunk_ph), layer->chunks_h - 1);
+		for (cy = y1; cy <= y2; ++cy) for (cx = x1; cx <= x2; ++cx) {
+			chunk = &layer->chunks[cx + cy * layer->chunks_w];
+			chunk->last_used = s_chunk_clock;
+			if (bake_only) {
+				if (chunk->bitmap == NULL)
+					bake_chunk(layer_index, cx, cy);
+				continue;
+			}
+			x = x_base + cx * chunk_pw;
+			y = y_base + cy * chunk_ph;
+			if (chunk->bitmap != NULL) {
+				al_draw_tinted_bitmap(chunk->bitmap, mask, x, y, 0x0);
+				for (i = 0; i < chunk->num_anim_cells; ++i) {
+					cell_x = chunk->anim_cells[i] % layer->width - cx * CHUNK_SIZE;
+					cell_y = chunk->anim_cells[i] / layer->width - cy * CHUNK_SIZE;
+					draw_tile(s_map->tileset, layer->color_mask, x + cell_x * tile_w, y + cell_y * tile_h,
+						layer->tilemap[chunk->anim_cells[i]].tile_index);
+				}
+			}
+			else {
+				// chunk couldn't be baked, fall back on drawing its tiles one by one
+				for (cell_y = cy * CHUNK_SIZE; cell_y < fmin((cy + 1) * CHUNK_SIZE, layer->height); ++cell_y)
+				for (cell_x = cx * CHUNK_SIZE; cell_x < fmin((cx + 1) * CHUNK_SIZE, layer->width); ++cell_x) {
+					draw_tile(s_map->tileset, layer->color_mask,
+						x + (cell_x - cx * CHUNK_SIZE) * tile_w, y + (cell_y - cy * CHUNK_SIZE) * tile_h,
+						layer->tilemap[cell_x + cell_y * layer->width].tile_index);
+				}
+			}
+		}
+	}
+}
+
+static void
+free_chunks(map_t* map, int layer_index)
+{
+	struct map_layer* layer;
+	
+	int i;
+
+	layer = &map->layers[layer_index];
+	if (layer->chunks == NULL)
+		return;
+	for (i = 0; i < layer->chunks_w * layer->chunks_h; ++i) {
+		if (layer->chunks[i].bitmap != NULL) {
+			al_destroy_bitmap(layer->chunks[i].bitmap);
+			--s_num_chunks;
+		}
+		free(layer->chunks[i].anim_cells);
+	}
+	free(layer->chunks);
+	layer->chunks = NULL;
+}
+
+static void
+draw_tile_window(int layer_index, int off_x, int off_y, bool is_repeating)
+{
+	// the tile window holds a vertex for every tile corner on screen, with the tiles
+	// laid out in layer coordinates and textured from the tileset atlas.  it wraps
+	// around in both directions so that scrolling only requires updating the rows and
+	// columns coming into view.  tiles whose image isn't in the atlas are drawn
+	// separately afterwards.
+	
+	ALLEGRO_BITMAP*     atlas;
+	bool                is_full_update;
+	struct map_layer*   layer;
+	ALLEGRO_TRANSFORM   old_transform;
+	int                 old_x, old_y;
+	struct window_slot* slot;
+	int                 tile_w, tile_h;
+	ALLEGRO_TRANSFORM   transform;
+	struct tile_window* window;
+	int                 x, y;
+
+	layer = &s_map->layers[layer_index];
+	window = &layer->window;
+	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	if (window->slots == NULL) {
+		window->cols = g_res_x / tile_w + 2;
+		window->rows = g_res_y / tile_h + 2;
+		window->slots = calloc(window->cols * window->rows, sizeof(struct window_slot));
+		window->verts = calloc(window->cols * window->rows * 6, sizeof(ALLEGRO_VERTEX));
+		if (window->slots == NULL || window->verts == NULL) {
+			free(window->slots); window->slots = NULL;
+			free(window->verts); window->verts = NULL;
+			return;
+		}
+	}
+	
+	// bring new rows and columns into view
+	old_x = window->x; old_y = window->y;
+	window->x = floor_div(off_x, tile_w);
+	window->y = floor_div(off_y, tile_h);
+	is_full_update = !window->is_valid || window->is_repeating != is_repeating
+		|| memcmp(&window->mask, &layer->color_mask, sizeof(color_t)) != 0;
+	if (is_full_update || window->x != old_x || window->y != old_y) {
+		if (is_full_update) {
+			memset(window->slots, 0, window->cols * window->rows * sizeof(struct window_slot));
+			window->num_animated = window->num_loose = 0;
+		}
+		window->mask = layer->color_mask;
+		window->is_repeating = is_repeating;
+		for (y = window->y; y < window->y + window->rows; ++y) for (x = window->x; x < window->x + window->cols; ++x) {
+			if (!is_full_update && x >= old_x && x < old_x + window->cols && y >= old_y && y < old_y + window->rows)
+				continue;
+			update_window_slot(layer_index, x, y);
+		}
+		window->is_valid = true;
+	}
+
+	// update animated tiles in place.  this can't go by the tileset's changed list,
+	// since that only covers the last animate_tileset() call and the animation also
+	// advances on frames that are never rendered.
+	if (window->num_animated > 0) {
+		for (y = window->y; y < window->y + window->rows; ++y) for (x = window->x; x < window->x + window->cols; ++x) {
+			slot = &window->slots[(y % window->rows + window->rows) % window->rows * window->cols
+				+ (x % window->cols + window->cols) % window->cols];
+			if (slot->is_animated && slot->frame != get_animated_tile(s_map->tileset, layer->tilemap[slot->map_index].tile_index))
+				update_window_slot(layer_index, x, y);
+		}
+	}
+	
+	// draw the whole layer in one go
+	atlas = get_image_bitmap(get_tile_atlas(s_map->tileset));
+	al_copy_transform(&old_transform, al_get_current_transform());
+	al_identity_transform(&transform);
+	al_translate_transform(&transform, -off_x, -off_y);
+	al_compose_transform(&transform, &old_transform);
+	al_use_transform(&transform);
+	al_draw_prim(window->verts, NULL, atlas, 0, window->cols * window->rows * 6, ALLEGRO_PRIM_TRIANGLE_LIST);
+	if (window->num_loose > 0) {
+		for (y = window->y; y < window->y + window->rows; ++y) for (x = window->x; x < window->x + window->cols; ++x) {
+			slot = &window->slots[(y % window->rows + window->rows) % window->rows * window->cols
+				+ (x % window->cols + window->cols) % window->cols];
+			if (slot->is_loose) {
+				draw_tile(s_map->tileset, layer->color_mask, x * tile_w, y * tile_h,
+					layer->tilemap[slot->map_index].tile_index);
+			}
+		}
+	}
+	al_use_transform(&old_transform);
+}
+
+static void
+free_tile_window(map_t* map, int layer_index)
+{
+	struct tile_window* window;
+
+	window = &map->layers[layer_index].window;
+	free(window->slots);
+	free(window->verts);
+	memset(window, 0, sizeof(struct tile_window));
+}
+
+static uint8_t
+get_walk_bits(int layer, int x, int y)
+{
+	uint8_t bits = 0x0;
+
+	int i;
+
+	for (i = 0; i < 4; ++i) {
+		if (is_move_blocked(layer, x, y, i))
+			bits |= 1 << i;
+	}
+	return bits;
+}
+
+static bool
+is_move_blocked(int layer, int x, int y, int direction)
+{
+	// a move between two neighboring cells is blocked if any obstruction crosses the
+	// line joining their centers.  a wall drawn along the edge between two tiles then
+	// blocks crossing that edge, but not walking around inside either tile.  the size
+	// of the mover isn't considered, so a gap narrower than a person's base still
+	// counts as open.
+	
+	static const int DX[4] = { 0, 1, 0, -1 };
+	static const int DY[4] = { -1, 0, 1, 0 };
+
+	bool              is_repeating;
+	rect_t            line;
+	const obsmap_t*   obsmap;
+	struct map_layer* p_layer;
+	int               tile_w, tile_h;
+	int               x2, y2;
+
+	int i, cx, cy;
+
+	p_layer = &s_map->layers[layer];
+	is_repeating = s_map->is_repeating || p_layer->is_parallax;
+	x2 = x + DX[direction];
+	y2 = y + DY[direction];
+	if (!is_repeating && (x2 < 0 || y2 < 0 || x2 >= p_layer->width || y2 >= p_layer->height))
+		return true;
+	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	line = new_rect(x * tile_w + tile_w / 2, y * tile_h + tile_h / 2,
+		x2 * tile_w + tile_w / 2, y2 * tile_h + tile_h / 2);
+	
+	// tile obstructions are tested in each tile's own coordinates
+	for (i = 0; i < 2; ++i) {
+		cx = i == 0 ? x : x2;
+		cy = i == 0 ? y : y2;
+		if (!is_map_tile_obstructive(cx, cy, layer))
+			continue;
+		obsmap = get_tile_obsmap(s_map->tileset, get_map_tile(cx, cy, layer));
+		if (test_obsmap_line(obsmap, new_rect(line.x1 - cx * tile_w, line.y1 - cy * tile_h,
+			line.x2 - cx * tile_w, line.y2 - cy * tile_h)))
+		{
+			return true;
+		}
+	}
+	return test_obsmap_line(p_layer->obsmap, line);
+}
+
+static void
+invalidate_cell(int layer_index, int x, int y)
+{
+	struct tile_chunk*  chunk;
+	int                 first_x, first_y;
+	struct map_layer*   layer;
+	int                 step_x, step_y;
+	struct tile_window* window;
+
+	int cx, cy;
+
+	layer = &s_map->layers[layer_index];
+	
+	// on a repeating layer, the cell may be in view more than once
+	window = &layer->window;
+	if (window->is_valid) {
+		first_x = window->is_repeating ? window->x + ((x - window->x) % layer->width + layer->width) % layer->width : x;
+		first_y = window->is_repeating ? window->y + ((y - window->y) % layer->height + layer->height) % layer->height : y;
+		step_x = window->is_repeating ? layer->width : window->cols;
+		step_y = window->is_repeating ? layer->height : window->rows;
+		for (cy = first_y; cy < window->y + window->rows; cy += step_y)
+		for (cx = first_x; cx < window->x + window->cols; cx += step_x) {
+			if (cx >= window->x && cy >= window->y)
+				update_window_slot(layer_index, cx, cy);
+		}
+	}
+	
+	if (layer->chunks == NULL)
+		return;
+	chunk = &layer->chunks[x / CHUNK_SIZE + y / CHUNK_SIZE * layer->chunks_w];
+	if (chunk->bitmap != NULL) {
+		al_destroy_bitmap(chunk->bitmap);
+		chunk->bitmap = NULL;
+		--s_num_chunks;
+	}
+}
+
+static void
+invalidate_tile(int tile_index)
+{
+	// invalidates all chunks where the image for tile_index was baked in
+	struct map_layer* layer;
+	int               map_index;
+
+	int x, y, z;
+
+	for (z = 0; z < s_map->num_layers; ++z) {
+		layer = &s_map->layers[z];
+		layer->window.is_valid = false;
+		if (layer->chunks == NULL)
+			continue;
+		for (y = 0; y < layer->height; ++y) for (x = 0; x < layer->width; ++x) {
+			map_index = layer->tilemap[x + y * layer->width].tile_index;
+			if (!is_tile_animated(s_map->tileset, map_index) && get_animated_tile(s_map->tileset, map_index) == tile_index)
+				invalidate_cell(z, x, y);
+		}
+	}
+}
+
+static void
+update_obs_bit(map_t* map, int layer, int x, int y)
+{
+	const obsmap_t*   obsmap = NULL;
+	struct map_layer* p_layer;
+	int               tile_index;
+
+	int i;
+
+	p_layer = &map->layers[layer];
+	i = x + y * p_layer->width;
+	tile_index = p_layer->tilemap[i].tile_index;
+	if (tile_index >= 0 && tile_index < get_tile_count(map->tileset))
+		obsmap = get_tile_obsmap(map->tileset, tile_index);
+	if (obsmap != NULL && !is_obsmap_empty(obsmap))
+		p_layer->obs_bits[i / 32] |= 1u << (i % 32);
+	else
+		p_layer->obs_bits[i / 32] &= ~(1u << (i % 32));
+}
+
+static void
+update_walk_cell(int layer, int x, int y)
+{
+	// call whenever a tile is changed, to keep the layer's obstruction bits and
+	// walkability grid in sync with it.  the tile's obstructions only affect moves
+	// across its own four edges, so the cell and the facing bits of its neighbors
+	// are all that need updating.
+	
+	static const int DX[4] = { 0, 1, 0, -1 };
+	static const int DY[4] = { -1, 0, 1, 0 };
+
+	uint8_t           bits;
+	bool              is_changed;
+	bool              is_repeating;
+	struct map_layer* p_layer;
+	uint8_t*          p_walk;
+	int               x2, y2;
+
+	int i;
+
+	p_layer = &s_map->layers[layer];
+	update_obs_bit(s_map, layer, x, y);
+	if (p_layer->walkmap == NULL)
+		return;
+	is_repeating = s_map->is_repeating || p_layer->is_parallax;
+	p_walk = &p_layer->walkmap[x + y * p_layer->width];
+	bits = get_walk_bits(layer, x, y);
+	is_changed = *p_walk != bits;
+	*p_walk = bits;
+	for (i = 0; i < 4; ++i) {
+		x2 = x + DX[i];
+		y2 = y + DY[i];
+		if (!is_repeating && (x2 < 0 || y2 < 0 || x2 >= p_layer->width || y2 >= p_layer->height))
+			continue;
+		x2 = (x2 % p_layer->width + p_layer->width) % p_layer->width;
+		y2 = (y2 % p_layer->height + p_layer->height) % p_layer->height;
+		p_walk = &p_layer->walkmap[x2 + y2 * p_layer->width];
+		
+		// the neighbor's bit for the shared edge points back the other way
+		if (bits & (1 << i))
+			*p_walk |= 1 << (i + 2) % 4;
+		else
+			*p_walk &= ~(1 << (i + 2) % 4);
+	}
+	if (is_changed)
+		repair_flow_fields(layer, x, y);
+}
+
+static void
+update_window_slot(int layer_index, int cell_x, int cell_y)
+{
+	ALLEGRO_COLOR       color;
+	struct map_layer*   layer;
+	int                 map_x, map_y;
+	struct window_slot* slot;
+	int                 tile_w, tile_h;
+	int                 u, v;
+	ALLEGRO_VERTEX*     verts;
+	struct tile_window* window;
+	float               x1, y1, x2, y2;
+
+	int i;
+
+	layer = &s_map->layers[layer_index];
+	window = &layer->window;
+	i = (cell_y % window->rows + window->rows) % window->rows * window->cols
+		+ (cell_x % window->cols + window->cols) % window->cols;
+	slot = &window->slots[i];
+	verts = &window->verts[i * 6];
+	if (slot->is_animated) --window->num_animated;
+	if (slot->is_loose) --window->num_loose;
+	slot->is_animated = slot->is_loose = false;
+	
+	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	map_x = window->is_repeating ? (cell_x % layer->width + layer->width) % layer->width : cell_x;
+	map_y = window->is_repeating ? (cell_y % layer->height + layer->height) % layer->height : cell_y;
+	x1 = cell_x * tile_w; x2 = x1 + tile_w;
+	y1 = cell_y * tile_h; y2 = y1 + tile_h;
+	if (map_x < 0 || map_x >= layer->width || map_y < 0 || map_y >= layer->height) {
+		memset(verts, 0, 6 * sizeof(ALLEGRO_VERTEX));  // off the map, degenerate quad
+		return;
+	}
+	slot->map_index = map_x + map_y * layer->width;
+	slot->frame = get_animated_tile(s_map->tileset, layer->tilemap[slot->map_index].tile_index);
+	slot->is_animated = is_tile_animated(s_map->tileset, layer->tilemap[slot->map_index].tile_index);
+	if (slot->is_animated) ++window->num_animated;
+	if (!get_tile_uv(s_map->tileset, slot->frame, &u, &v)) {
+		slot->is_loose = true;
+		++window->num_loose;
+		memset(verts, 0, 6 * sizeof(ALLEGRO_VERTEX));
+		return;
+	}
+	color = al_map_rgba(layer->color_mask.r, layer->color_mask.g, layer->color_mask.b, layer->color_mask.alpha);
+	verts[0].x = x1; verts[0].y = y1; verts[0].u = u; verts[0].v = v;
+	verts[1].x = x2; verts[1].y = y1; verts[1].u = u + tile_w; verts[1].v = v;
+	verts[2].x = x1; verts[2].y = y2; verts[2].u = u; verts[2].v = v + tile_h;
+	verts[3].x = x2; verts[3].y = y1; verts[3].u = u + tile_w; verts[3].v = v;
+	verts[4].x = x2; verts[4].y = y2; verts[4].u = u + tile_w; verts[4].v = v + tile_h;
+	verts[5].x = x1; verts[5].y = y2; verts[5].u = u; verts[5].v = v + tile_h;
+	for (i = 0; i < 6; ++i) {
+		verts[i].z = 0;
+		verts[i].color = color;
+	}
+}
+
 static void
 map_screen_to_layer(int layer, int camera_x, int camera_y, int* inout_x, int* inout_y)
 {
@@ -797,15 +2029,17 @@ process_map_input(void)
 {
 	ALLEGRO_KEYBOARD_STATE kb_state;
 	int                    mv_x = 0, mv_y = 0;
+	person_t*              person;
 
 	// clear out excess keys from key queue
 	clear_key_queue();
 	
 	// check for player control of input person, if there is one
-	if (s_input_person != NULL && !is_person_busy(s_input_person)) {
+	person = resolve_person_handle(s_input_person);
+	if (person != NULL && !is_person_busy(person)) {
 		al_get_keyboard_state(&kb_state);
 		if (al_key_down(&kb_state, s_talk_key) || is_joy_button_down(0, s_talk_button)) {
-			if (s_is_talk_allowed) talk_person(s_input_person);
+			if (s_is_talk_allowed) talk_person(person);
 			s_is_talk_allowed = false;
 		}
 		else // allow talking again only after key is released
@@ -816,40 +2050,40 @@ process_map_input(void)
 		if (al_key_down(&kb_state, ALLEGRO_KEY_LEFT)) mv_x = -1;
 		switch (mv_x + mv_y * 3) {
 		case -3: // north
-			queue_person_command(s_input_person, COMMAND_MOVE_NORTH, true);
-			queue_person_command(s_input_person, COMMAND_FACE_NORTH, false);
+			queue_person_command(person, COMMAND_MOVE_NORTH, true);
+			queue_person_command(person, COMMAND_FACE_NORTH, false);
 			break;
 		case -2: // northeast
-			queue_person_command(s_input_person, COMMAND_MOVE_NORTH, true);
-			queue_person_command(s_input_person, COMMAND_MOVE_EAST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_NORTHEAST, false);
+			queue_person_command(person, COMMAND_MOVE_NORTH, true);
+			queue_person_command(person, COMMAND_MOVE_EAST, true);
+			queue_person_command(person, COMMAND_FACE_NORTHEAST, false);
 			break;
 		case 1: // east
-			queue_person_command(s_input_person, COMMAND_MOVE_EAST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_EAST, false);
+			queue_person_command(person, COMMAND_MOVE_EAST, true);
+			queue_person_command(person, COMMAND_FACE_EAST, false);
 			break;
 		case 4: // southeast
-			queue_person_command(s_input_person, COMMAND_MOVE_SOUTH, true);
-			queue_person_command(s_input_person, COMMAND_MOVE_EAST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_SOUTHEAST, false);
+			queue_person_command(person, COMMAND_MOVE_SOUTH, true);
+			queue_person_command(person, COMMAND_MOVE_EAST, true);
+			queue_person_command(person, COMMAND_FACE_SOUTHEAST, false);
 			break;
 		case 3: // south
-			queue_person_command(s_input_person, COMMAND_MOVE_SOUTH, true);
-			queue_person_command(s_input_person, COMMAND_FACE_SOUTH, false);
+			queue_person_command(person, COMMAND_MOVE_SOUTH, true);
+			queue_person_command(person, COMMAND_FACE_SOUTH, false);
 			break;
 		case 2: // southwest
-			queue_person_command(s_input_person, COMMAND_MOVE_SOUTH, true);
-			queue_person_command(s_input_person, COMMAND_MOVE_WEST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_SOUTHWEST, false);
+			queue_person_command(person, COMMAND_MOVE_SOUTH, true);
+			queue_person_command(person, COMMAND_MOVE_WEST, true);
+			queue_person_command(person, COMMAND_FACE_SOUTHWEST, false);
 			break;
 		case -1: // west
-			queue_person_command(s_input_person, COMMAND_MOVE_WEST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_WEST, false);
+			queue_person_command(person, COMMAND_MOVE_WEST, true);
+			queue_person_command(person, COMMAND_FACE_WEST, false);
 			break;
 		case -4: // northwest
-			queue_person_command(s_input_person, COMMAND_MOVE_NORTH, true);
-			queue_person_command(s_input_person, COMMAND_MOVE_WEST, true);
-			queue_person_command(s_input_person, COMMAND_FACE_NORTHWEST, false);
+			queue_person_command(person, COMMAND_MOVE_NORTH, true);
+			queue_person_command(person, COMMAND_MOVE_WEST, true);
+			queue_person_command(person, COMMAND_FACE_NORTHWEST, false);
 			break;
 		}
 	}
@@ -858,21 +2092,22 @@ process_map_input(void)
 static void
 render_map(void)
 {
-	int               cell_x, cell_y;
-	int               first_cell_x, first_cell_y;
 	bool              is_repeating;
 	struct map_layer* layer;
 	int               layer_w, layer_h;
 	ALLEGRO_COLOR     overlay_color;
 	int               tile_w, tile_h;
 	int               off_x, off_y;
-	int               tile_index;
 	
-	int x, y, z;
+	int z;
 	
 	if (is_skipped_frame())
 		return;
+	++s_chunk_clock;
 	get_tile_size(s_map->tileset, &tile_w, &tile_h);
+	
+	// layers are normally drawn from the tileset atlas in one call each.  games can
+	// opt into the chunk cache instead by setting layer_renderer=chunks in game.sgm.
 	for (z = 0; z < s_map->num_layers; ++z) {
 		layer = &s_map->layers[z];
 		if (!layer->is_visible)
@@ -882,35 +2117,19 @@ render_map(void)
 		layer_h = layer->height * tile_h;
 		off_x = 0; off_y = 0;
 		map_screen_to_layer(z, s_cam_x, s_cam_y, &off_x, &off_y);
+		if (s_is_chunk_render)
+			draw_chunks(z, off_x, off_y, is_repeating, true);  // bake before holding
 		al_hold_bitmap_drawing(true);
-		if (layer->is_reflective) {
-			if (is_repeating) {
-				// for small repeating maps, persons need to be repeated as well
-				for (y = 0; y < g_res_y / layer_h + 2; ++y) for (x = 0; x < g_res_x / layer_w + 2; ++x)
-					render_persons(z, true, off_x - x * layer_w, off_y - y * layer_h);
-			}
-			else {
-				render_persons(z, true, off_x, off_y);
-			}
-		}
-		first_cell_x = off_x / tile_w;
-		first_cell_y = off_y / tile_h;
-		for (y = 0; y < g_res_y / tile_h + 2; ++y) for (x = 0; x < g_res_x / tile_w + 2; ++x) {
-			cell_x = is_repeating ? (x + first_cell_x) % layer->width : x + first_cell_x;
-			cell_y = is_repeating ? (y + first_cell_y) % layer->height : y + first_cell_y;
-			if (cell_x < 0 || cell_x >= layer->width || cell_y < 0 || cell_y >= layer->height)
-				continue;
-			tile_index = layer->tilemap[cell_x + cell_y * layer->width].tile_index;
-			draw_tile(s_map->tileset, layer->color_mask, x * tile_w - off_x % tile_w, y * tile_h - off_y % tile_h, tile_index);
-		}
-		if (is_repeating) {
-			// for small repeating maps, persons need to be repeated as well
-			for (y = 0; y < g_res_y / layer_h + 2; ++y) for (x = 0; x < g_res_x / layer_w + 2; ++x)
-				render_persons(z, false, off_x - x * layer_w, off_y - y * layer_h);
-		}
+		if (layer->is_reflective)
+			render_persons(z, true, off_x, off_y, is_repeating ? layer_w : 0, is_repeating ? layer_h : 0);
+		if (s_is_chunk_render)
+			draw_chunks(z, off_x, off_y, is_repeating, false);
 		else {
-			render_persons(z, false, off_x, off_y);
+			al_hold_bitmap_drawing(false);
+			draw_tile_window(z, off_x, off_y, is_repeating);
+			al_hold_bitmap_drawing(true);
 		}
+		render_persons(z, false, off_x, off_y, is_repeating ? layer_w : 0, is_repeating ? layer_h : 0);
 		al_hold_bitmap_drawing(false);
 		run_script(layer->render_script, false);
 	}
@@ -924,18 +2143,17 @@ update_map_engine(void)
 {
 	int                 index;
 	int                 last_trigger;
-	int                 last_zone;
 	int                 layer;
 	int                 map_w, map_h;
+	person_t*           person;
+	int                 script_id;
 	int                 script_type;
 	int                 tile_w, tile_h;
 	struct map_trigger* trigger;
 	double              x, y;
-	struct map_zone*    zone;
-
-	int i, j;
 	
 	++s_frames;
+	finish_prefetch(false);
 	get_tile_size(s_map->tileset, &tile_w, &tile_h);
 	map_w = s_map->width * tile_w;
 	map_h = s_map->height * tile_h;
@@ -951,14 +2169,14 @@ update_map_engine(void)
 	}
 	
 	// update camera
-	if (s_camera_person != NULL) {
-		get_person_xy(s_camera_person, &x, &y, true);
+	if ((person = resolve_person_handle(s_camera_person)) != NULL) {
+		get_person_xy(person, &x, &y, true);
 		s_cam_x = x; s_cam_y = y;
 	}
 
 	// run edge scripts if player walked off map (only for non-repeating map)
-	if (!s_map->is_repeating && s_input_person != NULL) {
-		get_person_xy(s_input_person, &x, &y, false);
+	if (!s_map->is_repeating && (person = resolve_person_handle(s_input_person)) != NULL) {
+		get_person_xy(person, &x, &y, false);
 		script_type = y < 0 ? MAP_SCRIPT_ON_LEAVE_NORTH
 			: x >= map_w ? MAP_SCRIPT_ON_LEAVE_EAST
 			: y >= map_h ? MAP_SCRIPT_ON_LEAVE_SOUTH
@@ -971,9 +2189,12 @@ update_map_engine(void)
 	}
 
 	// if the player moved the input person, process zones and triggers
-	if (s_input_person != NULL && has_person_moved(s_input_person)) {
+	// note: the edge scripts may have destroyed or detached the input person, so the
+	// handle has to be resolved again here.
+	person = resolve_person_handle(s_input_person);
+	if (person != NULL && has_person_moved(person)) {
 		// did we step on a trigger or move to a new one?
-		get_person_xyz(s_input_person, &x, &y, &layer, true);
+		get_person_xyz(person, &x, &y, &layer, true);
 		trigger = get_trigger_at(x, y, layer, &index);
 		if (trigger != s_on_trigger) {
 			last_trigger = s_current_trigger;
@@ -984,28 +2205,69 @@ update_map_engine(void)
 		}
 
 		// update any occupied zones
-		i = 0;
-		while (zone = get_zone_at(x, y, layer, i++, &index)) {
-			if (zone->steps_left-- <= 0) {
-				last_zone = s_current_zone;
-				s_current_zone = index;
-				zone->steps_left = zone->step_interval;
-				run_script(zone->script_id, true);
-				s_current_zone = last_zone;
-			}
-		}
+		if (!run_zones_at(x, y, layer, true))
+			duk_error_ni(g_duktape, -1, DUK_ERR_ERROR, "Failed to allocate zone list");
 	}
 	
 	run_script(s_update_script, false);
 	
-	// run delay scripts, if applicable
-	for (i = 0; i < s_num_delay_scripts; ++i) {
-		if (s_delay_scripts[i].frames_left-- <= 0) {
-			run_script(s_delay_scripts[i].script_id, false);
-			free_script(s_delay_scripts[i].script_id);
-			for (j = i; j < s_num_delay_scripts - 1; ++j) s_delay_scripts[j] = s_delay_scripts[j + 1];
-			--s_num_delay_scripts; --i;
-		}
+	// run delay scripts, if applicable.  the queue is a min-heap ordered by due frame,
+	// then by the order the scripts were queued in.  a script is removed from the queue
+	// before it runs, since it may queue more delay scripts.
+	++s_delay_clock;
+	while (s_num_delay_scripts > 0 && (int)(s_delay_scripts[0].due_frame - s_delay_clock) <= 0) {
+		script_id = s_delay_scripts[0].script_id;
+		s_delay_scripts[0] = s_delay_scripts[--s_num_delay_scripts];
+		sift_delay_down(0);
+		run_script(script_id, false);
+		free_script(script_id);
+	}
+}
+
+static bool
+is_delay_before(int index_a, int index_b)
+{
+	struct delay_script* a = &s_delay_scripts[index_a];
+	struct delay_script* b = &s_delay_scripts[index_b];
+
+	if (a->due_frame != b->due_frame)
+		return (int)(a->due_frame - b->due_frame) < 0;
+	else
+		return (int)(a->serial - b->serial) < 0;
+}
+
+static void
+sift_delay_down(int index)
+{
+	int                 child;
+	struct delay_script temp;
+
+	while ((child = index * 2 + 1) < s_num_delay_scripts) {
+		if (child + 1 < s_num_delay_scripts && is_delay_before(child + 1, child))
+			++child;
+		if (!is_delay_before(child, index))
+			break;
+		temp = s_delay_scripts[index];
+		s_delay_scripts[index] = s_delay_scripts[child];
+		s_delay_scripts[child] = temp;
+		index = child;
+	}
+}
+
+static void
+sift_delay_up(int index)
+{
+	int                 parent;
+	struct delay_script temp;
+
+	while (index > 0) {
+		parent = (index - 1) / 2;
+		if (!is_delay_before(index, parent))
+			break;
+		temp = s_delay_scripts[index];
+		s_delay_scripts[index] = s_delay_scripts[parent];
+		s_delay_scripts[parent] = temp;
+		index = parent;
 	}
 }
 
@@ -1081,6 +2343,7 @@ init_map_engine_api(duk_context* ctx)
 	register_api_func(ctx, NULL, "ExitMapEngine", js_ExitMapEngine);
 	register_api_func(ctx, NULL, "MapToScreenX", js_MapToScreenX);
 	register_api_func(ctx, NULL, "MapToScreenY", js_MapToScreenY);
+	register_api_func(ctx, NULL, "PrefetchMap", js_PrefetchMap);
 	register_api_func(ctx, NULL, "ReplaceTilesOnLayer", js_ReplaceTilesOnLayer);
 	register_api_func(ctx, NULL, "RenderMap", js_RenderMap);
 	register_api_func(ctx, NULL, "ScreenToMapX", js_ScreenToMapX);
@@ -1123,6 +2386,14 @@ js_MapEngine(duk_context* ctx)
 	const char* filename = duk_require_string(ctx, 0);
 	int framerate = duk_require_int(ctx, 1);
 	
+	const char* value;
+	
+	value = al_get_config_value(g_game_conf, NULL, "layered_triggers");
+	s_is_trigger_layers = value != NULL && strcasecmp(value, "true") == 0;
+	value = al_get_config_value(g_game_conf, NULL, "collision_mode");
+	s_is_mask_collision = value != NULL && strcasecmp(value, "bitmask") == 0;
+	value = al_get_config_value(g_game_conf, NULL, "layer_renderer");
+	s_is_chunk_render = value != NULL && strcasecmp(value, "chunks") == 0;
 	s_is_map_running = true;
 	s_exiting = false;
 	s_color_mask = rgba(0, 0, 0, 0);
@@ -1158,14 +2429,14 @@ js_AreZonesAt(duk_context* ctx)
 static duk_ret_t
 js_IsCameraAttached(duk_context* ctx)
 {
-	duk_push_boolean(ctx, s_camera_person != NULL);
+	duk_push_boolean(ctx, resolve_person_handle(s_camera_person) != NULL);
 	return 1;
 }
 
 static duk_ret_t
 js_IsInputAttached(duk_context* ctx)
 {
-	duk_push_boolean(ctx, s_input_person != NULL);
+	duk_push_boolean(ctx, resolve_person_handle(s_input_person) != NULL);
 	return 1;
 }
 
@@ -1218,9 +2489,11 @@ js_IsTriggerAt(duk_context* ctx)
 static duk_ret_t
 js_GetCameraPerson(duk_context* ctx)
 {
-	if (s_camera_person == NULL)
+	person_t* person;
+
+	if ((person = resolve_person_handle(s_camera_person)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetCameraPerson(): Invalid operation, camera not attached");
-	duk_push_string(ctx, get_person_name(s_camera_person));
+	duk_push_string(ctx, get_person_name(person));
 	return 1;
 }
 
@@ -1276,9 +2549,11 @@ js_GetCurrentZone(duk_context* ctx)
 static duk_ret_t
 js_GetInputPerson(duk_context* ctx)
 {
-	if (s_input_person == NULL)
+	person_t* person;
+
+	if ((person = resolve_person_handle(s_input_person)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetInputPerson(): Invalid operation, input not attached");
-	duk_push_string(ctx, get_person_name(s_input_person));
+	duk_push_string(ctx, get_person_name(person));
 	return 1;
 }
 
@@ -1666,7 +2941,9 @@ js_SetDelayScript(duk_context* ctx)
 	delay = &s_delay_scripts[s_num_delay_scripts - 1];
 	sprintf(script_name, "[%i-frame delay script]", frames);
 	delay->script_id = compile_script(script, script_name);
-	delay->frames_left = frames;
+	delay->due_frame = s_delay_clock + frames + 1;
+	delay->serial = s_delay_serial++;
+	sift_delay_up(s_num_delay_scripts - 1);
 	free_lstring(script);
 	return 0;
 }
@@ -1800,9 +3077,13 @@ js_SetTile(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTile(): Invalid layer index (caller passed: %i)", layer);
 	layer_w = s_map->layers[layer].width;
 	layer_h = s_map->layers[layer].height;
+	if (x < 0 || y < 0 || x >= layer_w || y >= layer_h)
+		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTile(): Tile coordinates out of range (%i,%i)", x, y);
 	struct map_tile* tilemap = s_map->layers[layer].tilemap;
 	tilemap[x + y * layer_w].tile_index = tile_index;
 	tilemap[x + y * layer_w].frames_left = get_tile_delay(s_map->tileset, tile_index);
+	invalidate_cell(layer, x, y);
+	update_walk_cell(layer, x, y);
 	return 0;
 }
 
@@ -1818,6 +3099,7 @@ js_SetTileDelay(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTileDelay(): Invalid tile index (%i)", tile_index);
 	if (delay < 0)
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetTileDelay(): Delay cannot be negative (%i)", delay);
+	invalidate_tile(tile_index);  // tile may start or stop animating
 	set_tile_delay(s_map->tileset, tile_index, delay);
 	return 0;
 }
@@ -1843,6 +3125,7 @@ js_SetTileImage(duk_context* ctx)
 	if (image_w != tile_w || image_h != tile_h)
 		duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "SetTileImage(): Image dimensions (%ix%i) don't match tile dimensions (%ix%i)", image_w, image_h, tile_w, tile_h);
 	set_tile_image(s_map->tileset, tile_index, image);
+	invalidate_tile(tile_index);
 	return 0;
 }
 
@@ -1871,6 +3154,7 @@ js_SetTileSurface(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetTileSurface(): Failed to create new tile image");
 	set_tile_image(s_map->tileset, tile_index, new_image);
 	free_image(new_image);
+	invalidate_tile(tile_index);
 	return 0;
 }
 
@@ -1909,7 +3193,7 @@ js_AttachCamera(duk_context* ctx)
 	name = duk_to_string(ctx, 0);
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "AttachCamera(): Person '%s' doesn't exist", name);
-	s_camera_person = person;
+	s_camera_person = get_person_handle(person);
 	return 0;
 }
 
@@ -1922,7 +3206,7 @@ js_AttachInput(duk_context* ctx)
 	name = duk_to_string(ctx, 0);
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "AttachInput(): Person '%s' doesn't exist", name);
-	s_input_person = person;
+	s_input_person = get_person_handle(person);
 	return 0;
 }
 
@@ -1967,14 +3251,14 @@ js_ChangeMap(duk_context* ctx)
 static duk_ret_t
 js_DetachCamera(duk_context* ctx)
 {
-	s_camera_person = NULL;
+	s_camera_person = 0;
 	return 0;
 }
 
 static duk_ret_t
 js_DetachInput(duk_context* ctx)
 {
-	s_input_person = NULL;
+	s_input_person = 0;
 	return 0;
 }
 
@@ -2007,21 +3291,10 @@ js_ExecuteZones(duk_context* ctx)
 	int y = duk_require_int(ctx, 1);
 	int layer = duk_require_map_layer(ctx, 2);
 
-	int              index;
-	int              last_zone;
-	struct map_zone* zone;
-
-	int i;
-
 	if (!is_map_engine_running())
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "ExecuteZones(): Map engine is not running");
-	i = 0;
-	while (zone = get_zone_at(x, y, layer, i++, &index)) {
-		last_zone = s_current_zone;
-		s_current_zone = index;
-		run_script(zone->script_id, true);
-		s_current_zone = last_zone;
-	}
+	if (!run_zones_at(x, y, layer, false))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "ExecuteZones(): Failed to allocate zone list");
 	return 0;
 }
 
@@ -2072,6 +3345,36 @@ js_MapToScreenY(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_PrefetchMap(duk_context* ctx)
+{
+	const char* filename = duk_require_string(ctx, 0);
+	
+	char* path;
+
+	path = get_asset_path(filename, "maps", false);
+	if (s_prefetch != NULL && strcmp(path, s_prefetch->path) == 0) {
+		free(path);
+		return 0;  // already on its way
+	}
+	if (find_cached_map(path) != NULL) {
+		free(path);
+		return 0;
+	}
+	
+	// only one map loads at a time.  if the loader is busy, the request waits its turn,
+	// replacing any request already waiting; the game thread never blocks on it.
+	finish_prefetch(false);
+	if (s_prefetch != NULL) {
+		free(s_prefetch_next);
+		s_prefetch_next = path;
+		return 0;
+	}
+	if (!start_prefetch(path))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "PrefetchMap(): Failed to start loader thread for '%s'", filename);
+	return 0;
+}
+
 static duk_ret_t
 js_RenderMap(duk_context* ctx)
 {
@@ -2103,7 +3406,11 @@ js_ReplaceTilesOnLayer(duk_context* ctx)
 	layer_h = s_map->layers[layer].height;
 	for (i_x = 0; i_x < layer_w; ++i_x) for (i_y = 0; i_y < layer_h; ++i_y) {
 		p_tile = &s_map->layers[layer].tilemap[i_x + i_y * layer_w];
-		if (p_tile->tile_index == old_index) p_tile->tile_index = new_index;
+		if (p_tile->tile_index == old_index) {
+			p_tile->tile_index = new_index;
+			invalidate_cell(layer, i_x, i_y);
+			update_walk_cell(layer, i_x, i_y);
+		}
 	}
 	return 0;
 }
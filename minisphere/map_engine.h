@@ -9,12 +9,15 @@ typedef struct map map_t;
 extern void             initialize_map_engine   (void);
 extern void             shutdown_map_engine     (void);
 extern bool             is_map_engine_running   (void);
+extern bool             is_map_tile_obstructive (int x, int y, int layer);
 extern rect_t           get_map_bounds          (void);
 extern const obsmap_t*  get_map_layer_obsmap    (int layer);
 extern point3_t         get_map_origin          (void);
 extern int              get_map_tile            (int x, int y, int layer);
 extern const tileset_t* get_map_tileset         (void);
+extern const uint8_t*   get_map_walkmap         (int layer, int* out_width, int* out_height, bool* out_is_repeating);
 extern void             normalize_map_entity_xy (double* inout_x, double* inout_y, int layer);
+extern bool             test_map_tile_rect      (int x, int y, int layer, rect_t rect);
 
 extern void             init_map_engine_api   (duk_context* ctx);
 extern int              duk_require_map_layer (duk_context* ctx, duk_idx_t index);
@@ -2,11 +2,32 @@
 
 #include "obsmap.h"
 
+static const int OBSMAP_CELL_SIZE = 64;
+static const int OBSMAP_GRID_MIN  = 32;
+
+static bool             add_line_to_grid (obsmap_t* obsmap, int line_index);
+static bool             build_grid       (obsmap_t* obsmap);
+static struct obs_cell* get_grid_cell    (const obsmap_t* obsmap, int x, int y);
+static bool             grow_grid        (obsmap_t* obsmap);
+static bool             insert_in_cell   (obsmap_t* obsmap, int x, int y, int line_index);
+
 struct obsmap
 {
-	int    num_lines;
-	int    max_lines;
-	rect_t *lines;
+	int             num_lines;
+	int             max_lines;
+	rect_t          *lines;
+	int             num_cells;
+	int             max_cells;
+	struct obs_cell *cells;
+};
+
+struct obs_cell
+{
+	bool is_used;
+	int  x, y;
+	int  num_lines;
+	int  max_lines;
+	int  *lines;
 };
 
 obsmap_t*
@@ -21,15 +42,44 @@ new_obsmap(void)
 	return obsmap;
 }
 
+obsmap_t*
+clone_obsmap(const obsmap_t* obsmap)
+{
+	obsmap_t* clone;
+
+	int i;
+
+	if ((clone = new_obsmap()) == NULL)
+		return NULL;
+	for (i = 0; i < obsmap->num_lines; ++i) {
+		if (!add_obsmap_line(clone, obsmap->lines[i])) {
+			free_obsmap(clone);
+			return NULL;
+		}
+	}
+	return clone;
+}
+
 void
 free_obsmap(obsmap_t* obsmap)
 {
+	int i;
+	
 	if (obsmap == NULL)
 		return;
+	for (i = 0; i < obsmap->max_cells; ++i)
+		free(obsmap->cells[i].lines);
+	free(obsmap->cells);
 	free(obsmap->lines);
 	free(obsmap);
 }
 
+bool
+is_obsmap_empty(const obsmap_t* obsmap)
+{
+	return obsmap->num_lines == 0;
+}
+
 bool
 add_obsmap_line(obsmap_t* obsmap, rect_t line)
 {
@@ -45,17 +95,42 @@ add_obsmap_line(obsmap_t* obsmap, rect_t line)
 	}
 	obsmap->lines[obsmap->num_lines] = line;
 	++obsmap->num_lines;
+	
+	// small obsmaps (e.g. for tiles) are faster to test without a grid
+	if (obsmap->cells != NULL)
+		return add_line_to_grid(obsmap, obsmap->num_lines - 1);
+	else if (obsmap->num_lines >= OBSMAP_GRID_MIN)
+		return build_grid(obsmap);
 	return true;
 }
 
 bool
 test_obsmap_line(const obsmap_t* obsmap, rect_t line)
 {
-	int i;
+	struct obs_cell* cell;
+	int              x1, y1, x2, y2;
+	
+	int i, x, y;
 
-	for (i = 0; i < obsmap->num_lines; ++i) {
-		if (do_lines_intersect(line, obsmap->lines[i]))
-			return true;
+	if (obsmap->cells == NULL) {
+		for (i = 0; i < obsmap->num_lines; ++i) {
+			if (do_lines_intersect(line, obsmap->lines[i]))
+				return true;
+		}
+	}
+	else {
+		x1 = floor(fmin(line.x1, line.x2) / (double)OBSMAP_CELL_SIZE);
+		y1 = floor(fmin(line.y1, line.y2) / (double)OBSMAP_CELL_SIZE);
+		x2 = floor(fmax(line.x1, line.x2) / (double)OBSMAP_CELL_SIZE);
+		y2 = floor(fmax(line.y1, line.y2) / (double)OBSMAP_CELL_SIZE);
+		for (y = y1; y <= y2; ++y) for (x = x1; x <= x2; ++x) {
+			if (!(cell = get_grid_cell(obsmap, x, y)))
+				continue;
+			for (i = 0; i < cell->num_lines; ++i) {
+				if (do_lines_intersect(line, obsmap->lines[cell->lines[i]]))
+					return true;
+			}
+		}
 	}
 	return false;
 }
@@ -63,8 +138,215 @@ test_obsmap_line(const obsmap_t* obsmap, rect_t line)
 bool
 test_obsmap_rect(const obsmap_t* obsmap, rect_t rect)
 {
-	return test_obsmap_line(obsmap, new_rect(rect.x1, rect.y1, rect.x2, rect.y1))
-		|| test_obsmap_line(obsmap, new_rect(rect.x2, rect.y1, rect.x2, rect.y2))
-		|| test_obsmap_line(obsmap, new_rect(rect.x1, rect.y2, rect.x2, rect.y2))
-		|| test_obsmap_line(obsmap, new_rect(rect.x1, rect.y1, rect.x1, rect.y2));
+	struct obs_cell* cell;
+	rect_t           edges[4];
+	rect_t           line;
+	int              x1, y1, x2, y2;
+
+	int i, j, x, y;
+
+	edges[0] = new_rect(rect.x1, rect.y1, rect.x2, rect.y1);
+	edges[1] = new_rect(rect.x2, rect.y1, rect.x2, rect.y2);
+	edges[2] = new_rect(rect.x1, rect.y2, rect.x2, rect.y2);
+	edges[3] = new_rect(rect.x1, rect.y1, rect.x1, rect.y2);
+	if (obsmap->cells == NULL) {
+		return test_obsmap_line(obsmap, edges[0])
+			|| test_obsmap_line(obsmap, edges[1])
+			|| test_obsmap_line(obsmap, edges[2])
+			|| test_obsmap_line(obsmap, edges[3]);
+	}
+
+	// only segments sharing a cell with the rectangle can cross its edges
+	x1 = floor(fmin(rect.x1, rect.x2) / (double)OBSMAP_CELL_SIZE);
+	y1 = floor(fmin(rect.y1, rect.y2) / (double)OBSMAP_CELL_SIZE);
+	x2 = floor(fmax(rect.x1, rect.x2) / (double)OBSMAP_CELL_SIZE);
+	y2 = floor(fmax(rect.y1, rect.y2) / (double)OBSMAP_CELL_SIZE);
+	for (y = y1; y <= y2; ++y) for (x = x1; x <= x2; ++x) {
+		if (!(cell = get_grid_cell(obsmap, x, y)))
+			continue;
+		for (i = 0; i < cell->num_lines; ++i) {
+			line = obsmap->lines[cell->lines[i]];
+			for (j = 0; j < 4; ++j) {
+				if (do_lines_intersect(edges[j], line))
+					return true;
+			}
+		}
+	}
+	return false;
+}
+
+bool
+test_obsmap_area(const obsmap_t* obsmap, rect_t area)
+{
+	// like test_obsmap_rect(), but also catches segments lying entirely inside the
+	// area, which don't cross any of its edges
+	
+	struct obs_cell* cell;
+	rect_t           line;
+	int              x1, y1, x2, y2;
+
+	int i, x, y;
+
+	if (test_obsmap_rect(obsmap, area))
+		return true;
+	if (obsmap->cells == NULL) {
+		for (i = 0; i < obsmap->num_lines; ++i) {
+			line = obsmap->lines[i];
+			if (line.x1 >= area.x1 && line.x1 <= area.x2 && line.y1 >= area.y1 && line.y1 <= area.y2)
+				return true;
+		}
+		return false;
+	}
+	x1 = floor(area.x1 / (double)OBSMAP_CELL_SIZE);
+	y1 = floor(area.y1 / (double)OBSMAP_CELL_SIZE);
+	x2 = floor(area.x2 / (double)OBSMAP_CELL_SIZE);
+	y2 = floor(area.y2 / (double)OBSMAP_CELL_SIZE);
+	for (y = y1; y <= y2; ++y) for (x = x1; x <= x2; ++x) {
+		if (!(cell = get_grid_cell(obsmap, x, y)))
+			continue;
+		for (i = 0; i < cell->num_lines; ++i) {
+			line = obsmap->lines[cell->lines[i]];
+			if (line.x1 >= area.x1 && line.x1 <= area.x2 && line.y1 >= area.y1 && line.y1 <= area.y2)
+				return true;
+		}
+	}
+	return false;
+}
+
+static bool
+add_line_to_grid(obsmap_t* obsmap, int line_index)
+{
+	// adds a segment to every grid cell it passes through.  the segment is walked one
+	// column at a time; the rows spanned within each column are padded by a pixel to
+	// absorb rounding, which only costs an extra test now and then.
+	
+	rect_t line;
+	double slope;
+	double x_start, x_end;
+	double y_start, y_end;
+	int    x1, x2;
+	
+	int x, y;
+
+	line = obsmap->lines[line_index];
+	if (line.x1 > line.x2)
+		line = new_rect(line.x2, line.y2, line.x1, line.y1);
+	x1 = floor(line.x1 / (double)OBSMAP_CELL_SIZE);
+	x2 = floor(line.x2 / (double)OBSMAP_CELL_SIZE);
+	slope = line.x2 != line.x1 ? (double)(line.y2 - line.y1) / (line.x2 - line.x1) : 0.0;
+	for (x = x1; x <= x2; ++x) {
+		x_start = fmax(line.x1, x * OBSMAP_CELL_SIZE);
+		x_end = fmin(line.x2, (x + 1) * OBSMAP_CELL_SIZE);
+		y_start = line.x2 != line.x1 ? line.y1 + (x_start - line.x1) * slope : line.y1;
+		y_end = line.x2 != line.x1 ? line.y1 + (x_end - line.x1) * slope : line.y2;
+		for (y = floor((fmin(y_start, y_end) - 1.0) / OBSMAP_CELL_SIZE);
+			y <= floor((fmax(y_start, y_end) + 1.0) / OBSMAP_CELL_SIZE); ++y)
+		{
+			if (!insert_in_cell(obsmap, x, y, line_index))
+				return false;
+		}
+	}
+	return true;
+}
+
+static bool
+build_grid(obsmap_t* obsmap)
+{
+	int i;
+
+	if (!grow_grid(obsmap))
+		return false;
+	for (i = 0; i < obsmap->num_lines; ++i) {
+		if (!add_line_to_grid(obsmap, i))
+			return false;
+	}
+	return true;
+}
+
+static unsigned int
+hash_cell(int x, int y)
+{
+	return (unsigned int)x * 73856093U ^ (unsigned int)y * 19349663U;
+}
+
+static struct obs_cell*
+get_grid_cell(const obsmap_t* obsmap, int x, int y)
+{
+	struct obs_cell* cell;
+	unsigned int     mask;
+	unsigned int     slot;
+
+	mask = obsmap->max_cells - 1;
+	slot = hash_cell(x, y) & mask;
+	for (; obsmap->cells[slot].is_used; slot = (slot + 1) & mask) {
+		cell = &obsmap->cells[slot];
+		if (cell->x == x && cell->y == y)
+			return cell;
+	}
+	return NULL;
+}
+
+static bool
+grow_grid(obsmap_t* obsmap)
+{
+	// grid cells live in an open-addressed hash table, so the grid doesn't need to know
+	// the extents of the obstruction map ahead of time
+	
+	struct obs_cell* new_cells;
+	int              new_size;
+	struct obs_cell* old_cells;
+	int              old_size;
+	unsigned int     slot;
+
+	int i;
+
+	new_size = obsmap->max_cells > 0 ? obsmap->max_cells * 2 : 64;
+	if (!(new_cells = calloc(new_size, sizeof(struct obs_cell))))
+		return false;
+	old_cells = obsmap->cells;
+	old_size = obsmap->max_cells;
+	for (i = 0; i < old_size; ++i) {
+		if (!old_cells[i].is_used)
+			continue;
+		slot = hash_cell(old_cells[i].x, old_cells[i].y) & (new_size - 1);
+		while (new_cells[slot].is_used)
+			slot = (slot + 1) & (new_size - 1);
+		new_cells[slot] = old_cells[i];
+	}
+	free(old_cells);
+	obsmap->cells = new_cells;
+	obsmap->max_cells = new_size;
+	return true;
+}
+
+static bool
+insert_in_cell(obsmap_t* obsmap, int x, int y, int line_index)
+{
+	struct obs_cell* cell;
+	int*             new_list;
+	int              new_size;
+	unsigned int     slot;
+
+	if (!(cell = get_grid_cell(obsmap, x, y))) {
+		if ((obsmap->num_cells + 1) * 2 > obsmap->max_cells && !grow_grid(obsmap))
+			return false;
+		slot = hash_cell(x, y) & (obsmap->max_cells - 1);
+		while (obsmap->cells[slot].is_used)
+			slot = (slot + 1) & (obsmap->max_cells - 1);
+		cell = &obsmap->cells[slot];
+		cell->is_used = true;
+		cell->x = x; cell->y = y;
+		++obsmap->num_cells;
+	}
+	if (cell->num_lines > 0 && cell->lines[cell->num_lines - 1] == line_index)
+		return true;  // already added
+	if (cell->num_lines + 1 > cell->max_lines) {
+		new_size = (cell->num_lines + 1) * 2;
+		if (!(new_list = realloc(cell->lines, new_size * sizeof(int))))
+			return false;
+		cell->lines = new_list;
+		cell->max_lines = new_size;
+	}
+	cell->lines[cell->num_lines++] = line_index;
+	return true;
 }
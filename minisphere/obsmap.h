@@ -4,8 +4,11 @@
 typedef struct obsmap obsmap_t;
 
 obsmap_t* new_obsmap       (void);
+obsmap_t* clone_obsmap     (const obsmap_t* obsmap);
 void      free_obsmap      (obsmap_t* obsmap);
+bool      is_obsmap_empty  (const obsmap_t* obsmap);
 bool      add_obsmap_line  (obsmap_t* obsmap, rect_t line);
+bool      test_obsmap_area (const obsmap_t* obsmap, rect_t area);
 bool      test_obsmap_line (const obsmap_t* obsmap, rect_t line);
 bool      test_obsmap_rect (const obsmap_t* obsmap, rect_t rect);
 
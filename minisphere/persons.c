@@ -9,32 +9,114 @@
 
 struct person
 {
-	char*          name;
-	int            anim_frames;
-	char*          direction;
-	int            frame;
-	bool           has_moved;
-	bool           ignore_all_persons;
-	bool           ignore_all_tiles;
-	bool           is_persistent;
-	bool           is_visible;
-	int            layer;
-	color_t        mask;
-	int            revert_delay;
-	int            revert_frames;
-	double         scale_x;
-	double         scale_y;
-	int            scripts[PERSON_SCRIPT_MAX];
-	double         speed_x, speed_y;
-	spriteset_t*   sprite;
-	double         theta;
-	double         x, y;
-	int            x_offset, y_offset;
-	int            max_commands;
-	int            num_ignores;
-	int            num_commands;
-	struct command *commands;
-	char*          *ignores;
+	const char*        name;
+	int                name_id;
+	char*              direction;
+	int                face_command;
+	int                facing_x, facing_y;
+	struct flow_field  *flow_field;
+	bool               ignore_all_persons;
+	bool               ignore_all_tiles;
+	bool               is_indexed;
+	bool               is_persistent;
+	bool               is_visible;
+	rect_t             index_cells;
+	int                index_layer;
+	int                list_index;
+	color_t            mask;
+	struct path_search *path_search;
+	int                revert_delay;
+	int                revert_frames;
+	double             scale_x;
+	double             scale_y;
+	int                scripts[PERSON_SCRIPT_MAX];
+	int                pose_index;
+	int                slot;
+	spriteset_t*       sprite;
+	double             theta;
+	int                x_offset, y_offset;
+	int                first_command;
+	int                max_commands;
+	int                num_ignores;
+	int                num_commands;
+	struct command     *commands;
+	int                *ignores;
+	int                ignore_words;
+	uint32_t           *ignore_bits;
+};
+
+struct person_hot
+{
+	int       num_slots;
+	int       max_slots;
+	int       num_free;
+	int       *free_slots;
+	int       *generations;
+	person_t* *persons;
+	double    *x, *y;
+	int       *layer;
+	double    *speed_x, *speed_y;
+	int       *frame;
+	int       *anim_frames;
+	bool      *has_moved;
+};
+
+struct path_node
+{
+	uint32_t f, h;
+	int      cell;
+};
+
+struct path_search
+{
+	int              layer;
+	int              width, height;
+	bool             is_repeating;
+	int              start, goal;
+	int              budget;
+	bool             is_done;
+	bool             is_found;
+	bool             is_immediate;
+	int              nodes_left;
+	int              num_open;
+	int              max_open;
+	struct path_node *open;
+	uint32_t         *costs;
+	int              *parents;
+	uint8_t          *closed;
+};
+
+struct flow_field
+{
+	int          layer;
+	int          width, height;
+	bool         is_repeating;
+	int          goal;
+	int          refcount;
+	unsigned int last_used;
+	uint32_t     *dists;
+};
+
+struct name_entry
+{
+	char*        name;
+	unsigned int hash;
+	person_t*    person;
+	int          refcount;
+};
+
+struct person_bucket
+{
+	int       num_persons;
+	int       max_persons;
+	person_t* *persons;
+};
+
+struct person_draw
+{
+	person_t* person;
+	int       order;
+	double    x, y;
 };
 
 struct command
@@ -52,7 +134,11 @@ static duk_ret_t js_IsIgnoringTileObstructions   (duk_context* ctx);
 static duk_ret_t js_IsPersonVisible              (duk_context* ctx);
 static duk_ret_t js_IsPersonObstructed           (duk_context* ctx);
 static duk_ret_t js_IsPersonVisible              (duk_context* ctx);
+static duk_ret_t js_IsPersonFindingPath          (duk_context* ctx);
+static duk_ret_t js_IsPersonFollowingFlowField   (duk_context* ctx);
 static duk_ret_t js_DoesPersonExist              (duk_context* ctx);
+static duk_ret_t js_FindPath                     (duk_context* ctx);
+static duk_ret_t js_FollowFlowField              (duk_context* ctx);
 static duk_ret_t js_GetCurrentPerson             (duk_context* ctx);
 static duk_ret_t js_GetObstructingPerson         (duk_context* ctx);
 static duk_ret_t js_GetObstructingTile           (duk_context* ctx);
@@ -106,21 +192,93 @@ static duk_ret_t js_ClearPersonCommands          (duk_context* ctx);
 static duk_ret_t js_IgnorePersonObstructions     (duk_context* ctx);
 static duk_ret_t js_IgnoreTileObstructions       (duk_context* ctx);
 static duk_ret_t js_QueuePersonCommand           (duk_context* ctx);
+static duk_ret_t js_QueuePersonCommands          (duk_context* ctx);
 static duk_ret_t js_QueuePersonScript            (duk_context* ctx);
 
-static void command_person       (person_t* person, int command);
-static int  compare_persons      (const void* a, const void* b);
-static void free_person          (person_t* person);
-static void set_person_direction (person_t* person, const char* direction);
-static void set_person_name      (person_t* person, const char* name);
-static void sort_persons         (void);
+static void                command_person       (person_t* person, int command);
+static struct path_search* begin_path_search    (const person_t* person, double x, double y, int max_nodes);
+static void                free_path_search     (struct path_search* search);
+static int                 compare_flow_nodes   (const void* a, const void* b);
+static void                follow_flow_field    (person_t* person);
+static void                free_flow_fields     (void);
+static struct flow_field*  get_flow_field       (int layer, double x, double y);
+static int                 get_flow_neighbor    (const struct flow_field* field, int cell, int direction);
+static bool                grow_flow_open       (void);
+static uint32_t            min_flow_neighbor    (const struct flow_field* field, int cell);
+static bool                pop_flow_node        (struct path_node* out_node);
+static void                propagate_flow_field (struct flow_field* field);
+static bool                push_flow_node       (uint32_t dist, int cell);
+static void                release_flow_field   (struct flow_field* field);
+static void                repair_flow_field    (struct flow_field* field, int cell);
+static int*                get_path_commands    (const person_t* person, const struct path_search* search, int* out_count);
+static bool                is_node_before       (const struct path_node* node, const struct path_node* other);
+static bool                queue_path           (person_t* person, const struct path_search* search, bool is_immediate);
+static bool                step_path_search     (struct path_search* search, int budget);
+static int                 compare_person_draws (const void* a, const void* b);
+static int                 compare_persons      (const void* a, const void* b);
+static person_t*           alloc_person         (void);
+static void                free_person          (person_t* person);
+static void                unlist_person        (person_t* person);
+static unsigned int        hash_name            (const char* name);
+static unsigned int        hash_person_cell     (int layer, int x, int y);
+static void                index_person         (person_t* person);
+static int                 intern_name          (const char* name, bool want_create);
+static bool                reserve_commands     (person_t* person, int count);
+static void                release_name         (int name_id);
+static bool                is_ignoring_id       (const person_t* person, int name_id);
+static void                unindex_person       (person_t* person);
+static void                set_person_direction (person_t* person, const char* direction);
+static void                set_person_name      (person_t* person, const char* name);
+static void                sort_persons         (void);
+static void                update_person        (person_t* person);
+static duk_ret_t           update_person_list   (duk_context* ctx);
+
+static const char* const FACE_NAMES[] =
+{
+	"north", "northeast", "east", "southeast",
+	"south", "southwest", "west", "northwest"
+};
 
-static const person_t* s_current_person = NULL;
-static int             s_def_scripts[PERSON_SCRIPT_MAX];
-static int             s_talk_distance  = 8;
-static int             s_max_persons    = 0;
-static int             s_num_persons    = 0;
-static person_t*       *s_persons       = NULL;
+static const int      FLOW_FIELD_CACHE = 16;
+static const uint32_t FLOW_UNREACHED   = 0xFFFFFFFF;
+static const int      PERSON_CELL_SIZE = 32;
+static const int      PERSON_BUCKETS   = 1024;
+static const int      PERSON_MAX_SLOTS = 65536;
+static const int      PERSON_POOL_SIZE = 64;
+
+static struct person_bucket *s_buckets        = NULL;
+static person_handle_t      s_current_person = 0;
+static struct person_hot    s_hot;
+static int                  s_def_scripts[PERSON_SCRIPT_MAX];
+static struct person_draw   *s_draws         = NULL;
+static unsigned int         s_flow_clock     = 0;
+static struct flow_field*   *s_flow_fields   = NULL;
+static int                  s_max_flow_open  = 0;
+static int                  s_max_fields     = 0;
+static int                  s_num_fields     = 0;
+static int                  s_num_flow_open  = 0;
+static struct path_node     *s_flow_open     = NULL;
+static struct person_bucket *s_layer_lists   = NULL;
+static int                  s_max_draws      = 0;
+static int                  s_max_names      = 0;
+static bool                 s_need_sort      = false;
+static int                  s_num_pools      = 0;
+static person_t*            *s_pools         = NULL;
+static int                  s_name_hash_size = 0;
+static int                  *s_name_hash     = NULL;
+static struct name_entry    *s_names         = NULL;
+static int                  *s_free_names    = NULL;
+static int                  s_num_draws      = 0;
+static int                  s_num_free_names = 0;
+static int                  s_num_lists      = 0;
+static int                  s_num_names      = 0;
+static int                  s_talk_distance  = 8;
+static int                  s_max_persons    = 0;
+static int                  s_max_updates    = 0;
+static int                  s_num_persons    = 0;
+static int                  s_num_updates    = 0;
+static person_t*            *s_persons       = NULL;
+static person_handle_t      *s_updates       = NULL;
 
 void
 initialize_persons_manager(void)
@@ -129,7 +287,8 @@ initialize_persons_manager(void)
 	s_num_persons = s_max_persons = 0;
 	s_persons = NULL;
 	s_talk_distance = 8;
-	s_current_person = NULL;
+	s_current_person = 0;
+	s_buckets = calloc(PERSON_BUCKETS, sizeof(struct person_bucket));
 }
 
 void
@@ -140,20 +299,62 @@ shutdown_persons_manager(void)
 	for (i = 0; i < s_num_persons; ++i)
 		free_person(s_persons[i]);
 	free(s_persons);
+	free(s_updates);
+	s_num_updates = s_max_updates = 0;
+	s_updates = NULL;
+	for (i = 0; i < PERSON_BUCKETS; ++i)
+		free(s_buckets[i].persons);
+	free(s_buckets);
+	for (i = 0; i < s_num_names; ++i)
+		free(s_names[i].name);
+	free(s_names);
+	free(s_name_hash);
+	free(s_free_names);
+	s_num_names = s_max_names = s_name_hash_size = s_num_free_names = 0;
+	s_names = NULL; s_name_hash = NULL; s_free_names = NULL;
+	free_flow_fields();
+	for (i = 0; i < s_num_lists; ++i)
+		free(s_layer_lists[i].persons);
+	free(s_layer_lists);
+	free(s_draws);
+	s_layer_lists = NULL; s_draws = NULL;
+	s_num_lists = s_num_draws = s_max_draws = 0;
+	for (i = 0; i < s_num_pools; ++i)
+		free(s_pools[i]);
+	free(s_pools);
+	s_pools = NULL; s_num_pools = 0;
+	free(s_hot.free_slots);
+	free(s_hot.generations);
+	free(s_hot.persons);
+	free(s_hot.x); free(s_hot.y);
+	free(s_hot.layer);
+	free(s_hot.speed_x); free(s_hot.speed_y);
+	free(s_hot.frame);
+	free(s_hot.anim_frames);
+	free(s_hot.has_moved);
+	memset(&s_hot, 0, sizeof(struct person_hot));
 }
 
 person_t*
 create_person(const char* name, const char* sprite_file, bool is_persistent)
 {
-	point3_t  map_origin = get_map_origin();
-	char*     path;
-	person_t* person;
+	point3_t   map_origin = get_map_origin();
+	person_t** new_persons;
+	int        new_size;
+	char*      path;
+	person_t*  person;
 
-	if (++s_num_persons > s_max_persons) {
-		s_max_persons = s_num_persons * 2;
-		s_persons = realloc(s_persons, s_max_persons * sizeof(person_t*));
+	if (s_num_persons >= s_max_persons) {
+		new_size = s_max_persons > 0 ? s_max_persons * 2 : 64;
+		if (!(new_persons = realloc(s_persons, new_size * sizeof(person_t*))))
+			return NULL;
+		s_persons = new_persons;
+		s_max_persons = new_size;
 	}
-	person = s_persons[s_num_persons - 1] = calloc(1, sizeof(person_t));
+	if (!(person = alloc_person()))
+		return NULL;
+	person->list_index = s_num_persons;
+	s_persons[s_num_persons++] = person;
 	set_person_name(person, name);
 	path = get_asset_path(sprite_file, "spritesets", false);
 	person->sprite = load_spriteset(path);
@@ -161,38 +362,58 @@ create_person(const char* name, const char* sprite_file, bool is_persistent)
 	set_person_direction(person, person->sprite->poses[0].name->cstr);
 	person->is_persistent = is_persistent;
 	person->is_visible = true;
-	person->x = map_origin.x;
-	person->y = map_origin.y;
-	person->layer = map_origin.z;
-	person->speed_x = 1.0;
-	person->speed_y = 1.0;
-	person->anim_frames = get_sprite_frame_delay(person->sprite, person->direction, 0);
+	s_hot.x[person->slot] = map_origin.x;
+	s_hot.y[person->slot] = map_origin.y;
+	s_hot.layer[person->slot] = map_origin.z;
+	s_hot.speed_x[person->slot] = 1.0;
+	s_hot.speed_y[person->slot] = 1.0;
+	s_hot.anim_frames[person->slot] = get_sprite_frame_delay(person->sprite, person->pose_index, 0);
 	person->mask = rgba(255, 255, 255, 255);
 	person->scale_x = person->scale_y = 1.0;
-	sort_persons();
+	index_person(person);
+	s_need_sort = true;
 	return person;
 }
 
 void
 destroy_person(person_t* person)
 {
-	int i, j;
+	person_handle_t handle;
 
+	handle = get_person_handle(person);
 	call_person_script(person, PERSON_SCRIPT_ON_DESTROY, true);
+	if (resolve_person_handle(handle) != person)
+		return;  // the destroy script already took care of it
+	unlist_person(person);
 	free_person(person);
-	for (i = 0; i < s_num_persons; ++i) {
-		if (s_persons[i] == person) {
-			for (j = i; j < s_num_persons - 1; ++j) s_persons[j] = s_persons[j + 1];
-			--s_num_persons; --i;
-		}
-	}
-	sort_persons();
+}
+
+person_handle_t
+get_person_handle(const person_t* person)
+{
+	// handles pair a person's slot with the slot's generation, which changes every
+	// time a person is freed, so a handle to a destroyed person never resolves to
+	// whoever takes over the slot
+	
+	return (person_handle_t)s_hot.generations[person->slot] << 16 | person->slot;
+}
+
+person_t*
+resolve_person_handle(person_handle_t handle)
+{
+	int slot = handle & 0xFFFF;
+
+	if (handle == 0 || slot >= s_hot.num_slots || s_hot.persons[slot] == NULL)
+		return NULL;
+	if (s_hot.generations[slot] != (int)(handle >> 16))
+		return NULL;
+	return s_hot.persons[slot];
 }
 
 bool
 has_person_moved(const person_t* person)
 {
-	return person->has_moved;
+	return s_hot.has_moved[person->slot];
 }
 
 bool
@@ -206,54 +427,76 @@ is_person_ignored(const person_t* person, const person_t* by_person)
 {
 	// note: commutative; if either person ignores the other, the function should return true
 
-	bool is_ignored = false;
-	
-	int i;
-
 	if (by_person->ignore_all_persons || person->ignore_all_persons)
 		return true;
-	for (i = 0; i < by_person->num_ignores; ++i)
-		if (strcmp(by_person->ignores[i], person->name) == 0) return true;
-	for (i = 0; i < person->num_ignores; ++i)
-		if (strcmp(person->ignores[i], by_person->name) == 0) return true;
-	return false;
+	return is_ignoring_id(by_person, person->name_id)
+		|| is_ignoring_id(person, by_person->name_id);
 }
 
 bool
 is_person_obstructed_at(const person_t* person, double x, double y, person_t** out_obstructing_person, int* out_tile_index)
 {
-	rect_t           area;
-	rect_t           base, my_base;
-	bool             collision = false;
-	double           cur_x, cur_y;
-	bool             is_obstructed = false;
-	int              layer;
-	const obsmap_t*  obsmap;
-	int              tile_w, tile_h;
-	const tileset_t* tileset;
+	rect_t               area;
+	rect_t               base, my_base;
+	struct person_bucket *bucket;
+	person_t*            candidate;
+	bool                 collision = false;
+	double               cur_x, cur_y;
+	bool                 is_obstructed = false;
+	int                  layer;
+	const obsmap_t*      obsmap;
+	person_t*            obs_person = NULL;
+	int                  tile_w, tile_h;
+	const tileset_t*     tileset;
 
 	int i, i_x, i_y;
 	
-	normalize_map_entity_xy(&x, &y, person->layer);
+	normalize_map_entity_xy(&x, &y, s_hot.layer[person->slot]);
 	get_person_xyz(person, &cur_x, &cur_y, &layer, true);
 	my_base = translate_rect(get_person_base(person), x - cur_x, y - cur_y);
 	if (out_obstructing_person) *out_obstructing_person = NULL;
 	if (out_tile_index) *out_tile_index = -1;
 
 	// check for obstructing persons
-	if (!person->ignore_all_persons) {
+	if (!person->ignore_all_persons && !is_map_engine_running()) {
 		for (i = 0; i < s_num_persons; ++i) {
 			if (s_persons[i] == person) continue;  // these persons aren't going to obstruct themselves
-			if (s_persons[i]->layer != layer) continue;  // ignore persons not on the same layer
+			if (s_hot.layer[s_persons[i]->slot] != layer) continue;  // ignore persons not on the same layer
 			if (is_person_ignored(person, s_persons[i])) continue;
 			base = get_person_base(s_persons[i]);
 			if (do_rects_intersect(my_base, base)) {
-				is_obstructed = true;
-				if (out_obstructing_person) *out_obstructing_person = s_persons[i];
+				obs_person = s_persons[i];
 				break;
 			}
 		}
 	}
+	else if (!person->ignore_all_persons) {
+		// only persons in the spatial hash buckets under our base can obstruct us.  if there
+		// are several, pick the one the unindexed search would have found first, i.e. the
+		// earliest in sort order.
+		area.x1 = floor((double)my_base.x1 / PERSON_CELL_SIZE);
+		area.y1 = floor((double)my_base.y1 / PERSON_CELL_SIZE);
+		area.x2 = floor((double)my_base.x2 / PERSON_CELL_SIZE);
+		area.y2 = floor((double)my_base.y2 / PERSON_CELL_SIZE);
+		for (i_y = area.y1; i_y <= area.y2; ++i_y) for (i_x = area.x1; i_x <= area.x2; ++i_x) {
+			bucket = &s_buckets[hash_person_cell(layer, i_x, i_y)];
+			for (i = 0; i < bucket->num_persons; ++i) {
+				candidate = bucket->persons[i];
+				if (candidate == person || s_hot.layer[candidate->slot] != layer)
+					continue;
+				if (obs_person != NULL && compare_persons(&candidate, &obs_person) >= 0)
+					continue;
+				if (is_person_ignored(person, candidate)) continue;
+				base = get_person_base(candidate);
+				if (do_rects_intersect(my_base, base))
+					obs_person = candidate;
+			}
+		}
+	}
+	if (obs_person != NULL) {
+		is_obstructed = true;
+		if (out_obstructing_person) *out_obstructing_person = obs_person;
+	}
 
 	// no obstructing person, check map-defined obstructions
 	obsmap = get_map_layer_obsmap(layer);
@@ -269,9 +512,10 @@ is_person_obstructed_at(const person_t* person, double x, double y, person_t** o
 		area.x2 = area.x1 + (my_base.x2 - my_base.x1) / tile_w + 2;
 		area.y2 = area.y1 + (my_base.y2 - my_base.y1) / tile_h + 2;
 		for (i_x = area.x1; i_x < area.x2; ++i_x) for (i_y = area.y1; i_y < area.y2; ++i_y) {
+			if (!is_map_tile_obstructive(i_x, i_y, layer))
+				continue;
 			base = translate_rect(my_base, -(i_x * tile_w), -(i_y * tile_h));
-			obsmap = get_tile_obsmap(tileset, get_map_tile(i_x, i_y, layer));
-			if (obsmap != NULL && test_obsmap_rect(obsmap, base)) {
+			if (test_map_tile_rect(i_x, i_y, layer, base)) {
 				is_obstructed = true;
 				if (out_tile_index) *out_tile_index = get_map_tile(i_x, i_y, layer);
 				break;
@@ -326,8 +570,8 @@ get_person_scale(const person_t* person, double* out_scale_x, double* out_scale_
 void
 get_person_speed(const person_t* person, double* out_x_speed, double* out_y_speed)
 {
-	if (out_x_speed) *out_x_speed = person->speed_x;
-	if (out_y_speed) *out_y_speed = person->speed_y;
+	if (out_x_speed) *out_x_speed = s_hot.speed_x[person->slot];
+	if (out_y_speed) *out_y_speed = s_hot.speed_y[person->slot];
 }
 
 spriteset_t*
@@ -339,18 +583,18 @@ get_person_spriteset(person_t* person)
 void
 get_person_xy(const person_t* person, double* out_x, double* out_y, bool want_normalize)
 {
-	*out_x = person->x;
-	*out_y = person->y;
+	*out_x = s_hot.x[person->slot];
+	*out_y = s_hot.y[person->slot];
 	if (want_normalize)
-		normalize_map_entity_xy(out_x, out_y, person->layer);
+		normalize_map_entity_xy(out_x, out_y, s_hot.layer[person->slot]);
 }
 
 void
 get_person_xyz(const person_t* person, double* out_x, double* out_y, int* out_layer, bool want_normalize)
 {
-	*out_x = person->x;
-	*out_y = person->y;
-	*out_layer = person->layer;
+	*out_x = s_hot.x[person->slot];
+	*out_y = s_hot.y[person->slot];
+	*out_layer = s_hot.layer[person->slot];
 	if (want_normalize)
 		normalize_map_entity_xy(out_x, out_y, *out_layer);
 }
@@ -372,10 +616,11 @@ set_person_scale(person_t* person, double scale_x, double scale_y)
 {
 	person->scale_x = scale_x;
 	person->scale_y = scale_y;
+	index_person(person);
 }
 
 bool
-set_person_script(person_t* person, int type, const lstring_t* script)
+set_person_script(person_t* person, int type, const lstring_t* script, bool is_deferred)
 {
 	char*       full_name;
 	const char* person_name;
@@ -393,7 +638,8 @@ set_person_script(person_t* person, int type, const lstring_t* script)
 	if ((full_name = malloc(strlen(person_name) + strlen(script_name) + 11)) == NULL)
 		return false;
 	sprintf(full_name, "[%s : %s]", person_name, script_name);
-	script_id = compile_script(script, full_name);
+	script_id = is_deferred ? defer_script(script, full_name)
+		: compile_script(script, full_name);
 	free_script(person->scripts[type]);
 	person->scripts[type] = script_id;
 	free(full_name);
@@ -403,8 +649,8 @@ set_person_script(person_t* person, int type, const lstring_t* script)
 void
 set_person_speed(person_t* person, double x_speed, double y_speed)
 {
-	person->speed_x = x_speed;
-	person->speed_y = y_speed;
+	s_hot.speed_x[person->slot] = x_speed;
+	s_hot.speed_y[person->slot] = y_speed;
 }
 
 void
@@ -414,30 +660,35 @@ set_person_spriteset(person_t* person, spriteset_t* spriteset)
 	
 	old_spriteset = person->sprite;
 	person->sprite = ref_spriteset(spriteset);
-	person->anim_frames = get_sprite_frame_delay(person->sprite, person->direction, 0);
-	person->frame = 0;
+	person->pose_index = get_sprite_pose_index(person->sprite, person->direction);
+	s_hot.anim_frames[person->slot] = get_sprite_frame_delay(person->sprite, person->pose_index, 0);
+	s_hot.frame[person->slot] = 0;
 	free_spriteset(old_spriteset);
+	index_person(person);
 }
 
 void
 set_person_xyz(person_t* person, double x, double y, int layer)
 {
-	person->x = x;
-	person->y = y;
-	person->layer = layer;
-	sort_persons();
+	s_hot.x[person->slot] = x;
+	s_hot.y[person->slot] = y;
+	s_hot.layer[person->slot] = layer;
+	index_person(person);
+	s_need_sort = true;
 }
 
 bool
 call_person_script(const person_t* person, int type, bool use_default)
 {
-	const person_t* last_person;
+	person_handle_t last_person;
+	int             script_id;
 
 	last_person = s_current_person;
-	s_current_person = person;
+	s_current_person = get_person_handle(person);
+	script_id = person->scripts[type];
 	if (use_default)
 		run_script(s_def_scripts[type], false);
-	run_script(person->scripts[type], false);
+	run_script(script_id, false);
 	s_current_person = last_person;
 	return true;
 }
@@ -445,99 +696,162 @@ call_person_script(const person_t* person, int type, bool use_default)
 person_t*
 find_person(const char* name)
 {
-	int i;
+	int name_id;
 
-	for (i = 0; i < s_num_persons; ++i) {
-		if (strcmp(name, s_persons[i]->name) == 0)
-			return s_persons[i];
-	}
-	return NULL;
+	if ((name_id = intern_name(name, false)) < 0)
+		return NULL;
+	return s_names[name_id].person;
 }
 
 bool
 queue_person_command(person_t* person, int command, bool is_immediate)
 {
+	struct command* slot;
+	
+	if (!reserve_commands(person, 1))
+		return false;
+	slot = &person->commands[(person->first_command + person->num_commands) % person->max_commands];
+	slot->type = command;
+	slot->is_immediate = is_immediate;
+	slot->script_id = 0;
 	++person->num_commands;
-	if (person->num_commands > person->max_commands) {
-		if (!(person->commands = realloc(person->commands, person->num_commands * sizeof(struct command))))
-			return false;
-		person->max_commands = person->num_commands;
-	}
-	person->commands[person->num_commands - 1].type = command;
-	person->commands[person->num_commands - 1].is_immediate = is_immediate;
-	person->commands[person->num_commands - 1].script_id = 0;
 	return true;
 }
 
 bool
 queue_person_script(person_t* person, lstring_t* script, bool is_immediate)
 {
-	lstring_t* script_name;
+	lstring_t*      script_name;
+	struct command* slot;
 	
-	++person->num_commands;
-	if (person->num_commands > person->max_commands) {
-		if (!(person->commands = realloc(person->commands, person->num_commands * sizeof(struct command))))
-			return false;
-		person->max_commands = person->num_commands;
-	}
-	if ((script_name = malloc(strlen(person->name) + 19)) == NULL)
+	if (!reserve_commands(person, 1))
 		return false;
-	script_name = new_lstring("[%s : queued script]", person->name);
-	person->commands[person->num_commands - 1].type = COMMAND_RUN_SCRIPT;
-	person->commands[person->num_commands - 1].is_immediate = is_immediate;
-	person->commands[person->num_commands - 1].script_id = compile_script(script, script_name->cstr);
+	if (!(script_name = new_lstring("[%s : queued script]", person->name)))
+		return false;
+	slot = &person->commands[(person->first_command + person->num_commands) % person->max_commands];
+	slot->type = COMMAND_RUN_SCRIPT;
+	slot->is_immediate = is_immediate;
+	slot->script_id = compile_script(script, script_name->cstr);
+	free_lstring(script_name);
+	++person->num_commands;
 	return true;
 }
 
 void
-render_persons(int layer, bool is_flipped, int cam_x, int cam_y)
+render_persons(int layer, bool is_flipped, int cam_x, int cam_y, int wrap_w, int wrap_h)
 {
-	person_t*    person;
-	spriteset_t* sprite;
-	int          w, h;
-	double       x, y;
-	int          i;
+	// draws the persons on a layer, skipping any whose sprite falls entirely off
+	// screen.  on a repeating layer (wrap_w and wrap_h nonzero), each person is drawn
+	// once for every wrapped copy of them that lands on screen.  everything to be
+	// drawn is collected first and sorted, so copies still overlap correctly.
+	
+	rect_t                base;
+	struct person_bucket* list;
+	struct person_draw*   new_draws;
+	int                   new_size;
+	person_t*             person;
+	double                radius;
+	spriteset_t*          sprite;
+	int                   w, h;
+	double                x, y;
+	double                center_x, center_y;
+	int                   kx1, ky1, kx2, ky2;
+
+	int i, kx, ky;
 
-	for (i = 0; i < s_num_persons; ++i) {
-		person = s_persons[i];
-		if (!person->is_visible || person->layer != layer)
+	sort_persons();
+	if (layer >= s_num_lists)
+		return;
+	list = &s_layer_lists[layer];
+	s_num_draws = 0;
+	for (i = 0; i < list->num_persons; ++i) {
+		person = list->persons[i];
+		if (!person->is_visible)
 			continue;
 		sprite = person->sprite;
 		get_sprite_size(sprite, &w, &h);
+		base = get_sprite_base(sprite);
 		get_person_xy(person, &x, &y, true);
 		x -= cam_x - person->x_offset;
 		y -= cam_y - person->y_offset;
-		draw_sprite(sprite, person->mask, is_flipped, person->theta, person->scale_x, person->scale_y,
-			person->direction, x, y, person->frame);
+		
+		// bounding circle of the sprite as draw_sprite() places it, large enough to
+		// cover any scaling or rotation
+		center_x = x - (base.x1 + base.x2) / 2 + w / 2.0;
+		center_y = y - (is_flipped ? 0 : (base.y1 + base.y2) / 2) + h / 2.0;
+		radius = sqrt(w * w + h * h) / 2 * fmax(fabs(person->scale_x), fabs(person->scale_y));
+		kx1 = wrap_w > 0 ? ceil((-radius - center_x) / wrap_w) : 0;
+		kx2 = wrap_w > 0 ? floor((g_res_x + radius - center_x) / wrap_w) : 0;
+		ky1 = wrap_h > 0 ? ceil((-radius - center_y) / wrap_h) : 0;
+		ky2 = wrap_h > 0 ? floor((g_res_y + radius - center_y) / wrap_h) : 0;
+		for (ky = ky1; ky <= ky2; ++ky) for (kx = kx1; kx <= kx2; ++kx) {
+			if (center_x + kx * wrap_w + radius < 0 || center_x + kx * wrap_w - radius > g_res_x
+				|| center_y + ky * wrap_h + radius < 0 || center_y + ky * wrap_h - radius > g_res_y)
+			{
+				continue;
+			}
+			if (s_num_draws >= s_max_draws) {
+				new_size = s_max_draws > 0 ? s_max_draws * 2 : 64;
+				if (!(new_draws = realloc(s_draws, new_size * sizeof(struct person_draw))))
+					break;
+				s_draws = new_draws;
+				s_max_draws = new_size;
+			}
+			s_draws[s_num_draws].person = person;
+			s_draws[s_num_draws].order = s_num_draws;
+			s_draws[s_num_draws].x = x + kx * wrap_w;
+			s_draws[s_num_draws].y = y + ky * wrap_h;
+			++s_num_draws;
+		}
+	}
+	if (wrap_w > 0 || wrap_h > 0)
+		qsort(s_draws, s_num_draws, sizeof(struct person_draw), compare_person_draws);
+	for (i = 0; i < s_num_draws; ++i) {
+		person = s_draws[i].person;
+		draw_sprite(person->sprite, person->mask, is_flipped, person->theta, person->scale_x, person->scale_y,
+			person->pose_index, s_draws[i].x, s_draws[i].y, s_hot.frame[person->slot]);
 	}
 }
 
 void
 reset_persons(map_t* map, bool keep_existing)
 {
-	point3_t  map_origin;
-	person_t* person;
+	person_handle_t handle;
+	point3_t        map_origin;
+	person_t*       person;
 	
-	int i, j;
+	int i;
 
 	map_origin = get_map_origin();
 	for (i = 0; i < s_num_persons; ++i) {
 		person = s_persons[i];
 		if (person->is_persistent || keep_existing) {
-			person->x = map_origin.x;
-			person->y = map_origin.y;
-			person->layer = map_origin.z;
+			free_path_search(person->path_search);
+			person->path_search = NULL;
+			person->flow_field = NULL;
+			s_hot.x[person->slot] = map_origin.x;
+			s_hot.y[person->slot] = map_origin.y;
+			s_hot.layer[person->slot] = map_origin.z;
 			call_person_script(person, PERSON_SCRIPT_ON_CREATE, true);
 		}
 		else {
+			handle = get_person_handle(person);
 			call_person_script(person, PERSON_SCRIPT_ON_DESTROY, true);
-			free_person(person);
-			--s_num_persons;
-			for (j = i; j < s_num_persons; ++j) s_persons[j] = s_persons[j + 1];
+			if (resolve_person_handle(handle) == person) {
+				unlist_person(person);
+				free_person(person);
+			}
 			--i;
 		}
 	}
-	sort_persons();
+	
+	// flow fields are only good for the map they were built on
+	free_flow_fields();
+	
+	// base rects depend on the map's size when it repeats, so reindex everyone
+	for (i = 0; i < s_num_persons; ++i)
+		index_person(s_persons[i]);
+	s_need_sort = true;
 }
 
 void
@@ -551,10 +865,8 @@ talk_person(const person_t* person)
 	
 	// check if anyone else is within earshot
 	get_person_xy(person, &talk_x, &talk_y, true);
-	if (strstr(person->direction, "north") != NULL) talk_y -= s_talk_distance;
-	if (strstr(person->direction, "east") != NULL) talk_x += s_talk_distance;
-	if (strstr(person->direction, "south") != NULL) talk_y += s_talk_distance;
-	if (strstr(person->direction, "west") != NULL) talk_x -= s_talk_distance;
+	talk_x += person->facing_x * s_talk_distance;
+	talk_y += person->facing_y * s_talk_distance;
 	is_person_obstructed_at(person, talk_x, talk_y, &target_person, NULL);
 	
 	// if so, call their talk script
@@ -565,38 +877,53 @@ talk_person(const person_t* person)
 void
 update_persons(void)
 {
-	struct command  command;
-	bool            is_finished;
-	const person_t* last_person;
-	person_t*       person;
+	// persons are updated in depth order, same as they're drawn.  the order decides
+	// things like who gets a contested tile and which touch scripts fire first.  scripts
+	// can create and destroy persons along the way, so the order is snapshotted as
+	// handles up front; persons destroyed in the meantime don't resolve and are skipped.
+	// UpdateMapEngine() can re-enter this, so snapshots stack on top of each other and
+	// are popped even if a script throws.
 	
-	int i, j;
+	int              base;
+	person_handle_t* new_updates;
+	int              new_size;
+	int              result;
 
-	for (i = 0; i < s_num_persons; ++i) {
-		person = s_persons[i];
-		person->has_moved = false;
-		if (person->revert_delay > 0 && --person->revert_frames <= 0)
-			person->frame = 0;
-		if (person->num_commands == 0)
-			call_person_script(person, PERSON_SCRIPT_GENERATOR, true);
-		
-		// run through the command queue, stopping after the first non-immediate command
-		is_finished = person->num_commands == 0;
-		while (!is_finished) {
-			command = person->commands[0];
-			--person->num_commands;
-			for (j = 0; j < person->num_commands; ++j)
-				person->commands[j] = person->commands[j + 1];
-			last_person = s_current_person;
-			s_current_person = person;
-			if (command.type != COMMAND_RUN_SCRIPT)
-				command_person(person, command.type);
-			else
-				run_script(command.script_id, false);
-			s_current_person = last_person;
-			free_script(command.script_id);
-			is_finished = !command.is_immediate || person->num_commands == 0;
-		}
+	int i;
+
+	sort_persons();
+	base = s_num_updates;
+	if (base + s_num_persons > s_max_updates) {
+		new_size = (base + s_num_persons) * 2;
+		if (!(new_updates = realloc(s_updates, new_size * sizeof(person_handle_t))))
+			duk_error_ni(g_duktape, -1, DUK_ERR_ERROR, "Failed to allocate person update list");
+		s_updates = new_updates;
+		s_max_updates = new_size;
+	}
+	for (i = 0; i < s_num_persons; ++i)
+		s_updates[s_num_updates++] = get_person_handle(s_persons[i]);
+	if (s_hot.num_slots > 0)
+		memset(s_hot.has_moved, 0, s_hot.num_slots * sizeof(bool));
+	duk_push_int(g_duktape, base);
+	duk_push_int(g_duktape, s_num_updates - base);
+	result = duk_safe_call(g_duktape, update_person_list, 2, 1);
+	s_num_updates = base;
+	if (result != DUK_EXEC_SUCCESS)
+		duk_throw(g_duktape);
+	duk_pop(g_duktape);
+}
+
+void
+repair_flow_fields(int layer, int x, int y)
+{
+	struct flow_field* field;
+	
+	int i;
+
+	for (i = 0; i < s_num_fields; ++i) {
+		field = s_flow_fields[i];
+		if (field->layer == layer)
+			repair_flow_field(field, x + y * field->width);
 	}
 }
 
@@ -614,7 +941,11 @@ init_persons_api(void)
 	register_api_func(g_duktape, NULL, "IsIgnoringTileObstructions", js_IsIgnoringTileObstructions);
 	register_api_func(g_duktape, NULL, "IsPersonObstructed", js_IsPersonObstructed);
 	register_api_func(g_duktape, NULL, "IsPersonVisible", js_IsPersonVisible);
+	register_api_func(g_duktape, NULL, "IsPersonFindingPath", js_IsPersonFindingPath);
+	register_api_func(g_duktape, NULL, "IsPersonFollowingFlowField", js_IsPersonFollowingFlowField);
 	register_api_func(g_duktape, NULL, "DoesPersonExist", js_DoesPersonExist);
+	register_api_func(g_duktape, NULL, "FindPath", js_FindPath);
+	register_api_func(g_duktape, NULL, "FollowFlowField", js_FollowFlowField);
 	register_api_func(g_duktape, NULL, "GetCurrentPerson", js_GetCurrentPerson);
 	register_api_func(g_duktape, NULL, "GetObstructingPerson", js_GetObstructingPerson);
 	register_api_func(g_duktape, NULL, "GetObstructingTile", js_GetObstructingTile);
@@ -668,6 +999,7 @@ init_persons_api(void)
 	register_api_func(g_duktape, NULL, "IgnorePersonObstructions", js_IgnorePersonObstructions);
 	register_api_func(g_duktape, NULL, "IgnoreTileObstructions", js_IgnoreTileObstructions);
 	register_api_func(g_duktape, NULL, "QueuePersonCommand", js_QueuePersonCommand);
+	register_api_func(g_duktape, NULL, "QueuePersonCommands", js_QueuePersonCommands);
 	register_api_func(g_duktape, NULL, "QueuePersonScript", js_QueuePersonScript);
 
 	// movement script specifier constants
@@ -698,40 +1030,1104 @@ init_persons_api(void)
 	register_api_const(g_duktape, "COMMAND_MOVE_NORTHWEST", COMMAND_MOVE_NORTHWEST);
 }
 
+static struct path_search*
+begin_path_search(const person_t* person, double x, double y, int max_nodes)
+{
+	// sets up an A* search over the walkability grid of the person's layer, from the
+	// tile under the person to the tile containing (x, y).  the search itself is run
+	// by step_path_search(), which can spread the work over several frames.
+	
+	int                goal_x, goal_y;
+	double             person_x, person_y;
+	struct path_search *search;
+	int                start_x, start_y;
+	int                tile_w, tile_h;
+	const uint8_t*     walkmap;
+
+	if (!(search = calloc(1, sizeof(struct path_search))))
+		return NULL;
+	search->layer = s_hot.layer[person->slot];
+	if (!(walkmap = get_map_walkmap(search->layer, &search->width, &search->height, &search->is_repeating)))
+		goto on_error;
+	get_tile_size(get_map_tileset(), &tile_w, &tile_h);
+	get_person_xy(person, &person_x, &person_y, true);
+	start_x = floor(person_x / tile_w);
+	start_y = floor(person_y / tile_h);
+	goal_x = floor(x / tile_w);
+	goal_y = floor(y / tile_h);
+	if (search->is_repeating) {
+		goal_x = (goal_x % search->width + search->width) % search->width;
+		goal_y = (goal_y % search->height + search->height) % search->height;
+	}
+	start_x = start_x < 0 ? 0 : start_x >= search->width ? search->width - 1 : start_x;
+	start_y = start_y < 0 ? 0 : start_y >= search->height ? search->height - 1 : start_y;
+	search->start = start_x + start_y * search->width;
+	search->goal = goal_x + goal_y * search->width;
+	search->nodes_left = max_nodes > 0 ? max_nodes : -1;
+	if (!(search->costs = malloc(search->width * search->height * sizeof(uint32_t))))
+		goto on_error;
+	if (!(search->parents = malloc(search->width * search->height * sizeof(int))))
+		goto on_error;
+	if (!(search->closed = calloc(search->width * search->height, sizeof(uint8_t))))
+		goto on_error;
+	memset(search->costs, 0xFF, search->width * search->height * sizeof(uint32_t));
+	if (goal_x < 0 || goal_y < 0 || goal_x >= search->width || goal_y >= search->height
+		|| walkmap[search->goal] == 0x0F)
+	{
+		// goal is off the map or walled in on all four sides, no point searching
+		search->is_done = true;
+		return search;
+	}
+	
+	// seed the open list with the start cell
+	search->max_open = 64;
+	if (!(search->open = malloc(search->max_open * sizeof(struct path_node))))
+		goto on_error;
+	search->costs[search->start] = 0;
+	search->parents[search->start] = -1;
+	search->open[0].cell = search->start;
+	search->open[0].f = search->open[0].h = 0;
+	search->num_open = 1;
+	return search;
+
+on_error:
+	free_path_search(search);
+	return NULL;
+}
+
+static void
+free_path_search(struct path_search* search)
+{
+	if (search == NULL)
+		return;
+	free(search->open);
+	free(search->costs);
+	free(search->parents);
+	free(search->closed);
+	free(search);
+}
+
+static int
+compare_flow_nodes(const void* a, const void* b)
+{
+	const struct path_node* node1 = a;
+	const struct path_node* node2 = b;
+
+	return node1->f < node2->f ? -1 : node1->f > node2->f ? 1 : 0;
+}
+
+static void
+follow_flow_field(person_t* person)
+{
+	// queues the commands to take a person one tile further along their flow field.
+	// only the four tiles around them are looked at, so this costs the same no matter
+	// how many persons share the field.  the person stops following once they reach
+	// the goal or leave the field's layer.
+	
+	static const int FACE_COMMANDS[4] = { COMMAND_FACE_NORTH, COMMAND_FACE_EAST, COMMAND_FACE_SOUTH, COMMAND_FACE_WEST };
+	static const int MOVE_COMMANDS[4] = { COMMAND_MOVE_NORTH, COMMAND_MOVE_EAST, COMMAND_MOVE_SOUTH, COMMAND_MOVE_WEST };
+	
+	int                best_direction = -1;
+	uint32_t           best_dist;
+	int                cell;
+	struct flow_field* field;
+	int                next;
+	int                num_steps;
+	double             person_x, person_y;
+	double             speed;
+	int                tile_w, tile_h;
+	const uint8_t*     walkmap;
+	int                x, y;
+
+	int i;
+
+	field = person->flow_field;
+	if (s_hot.layer[person->slot] != field->layer)
+		goto on_finished;
+	get_tile_size(get_map_tileset(), &tile_w, &tile_h);
+	get_person_xy(person, &person_x, &person_y, true);
+	x = floor(person_x / tile_w);
+	y = floor(person_y / tile_h);
+	if (field->is_repeating) {
+		x = (x % field->width + field->width) % field->width;
+		y = (y % field->height + field->height) % field->height;
+	}
+	else if (x < 0 || y < 0 || x >= field->width || y >= field->height)
+		return;  // off the map, wait for them to come back
+	cell = x + y * field->width;
+	if (cell == field->goal)
+		goto on_finished;
+	
+	// step toward whichever neighbor is closest to the goal.  if the person is stuck
+	// somewhere the goal can't be reached from, they'll just wait until a tile changes.
+	walkmap = get_map_walkmap(field->layer, NULL, NULL, NULL);
+	best_dist = field->dists[cell];
+	for (i = 0; i < 4; ++i) {
+		if (walkmap[cell] & 1 << i)
+			continue;
+		if ((next = get_flow_neighbor(field, cell, i)) >= 0 && field->dists[next] < best_dist) {
+			best_direction = i;
+			best_dist = field->dists[next];
+		}
+	}
+	if (best_direction < 0)
+		return;
+	speed = best_direction % 2 == 0 ? s_hot.speed_y[person->slot] : s_hot.speed_x[person->slot];
+	num_steps = ceil((best_direction % 2 == 0 ? tile_h : tile_w) / (speed > 0.0 ? speed : 1.0));
+	if (!reserve_commands(person, num_steps + 1))
+		return;
+	queue_person_command(person, FACE_COMMANDS[best_direction], false);
+	for (i = 0; i < num_steps; ++i)
+		queue_person_command(person, MOVE_COMMANDS[best_direction], false);
+	return;
+
+on_finished:
+	release_flow_field(field);
+	person->flow_field = NULL;
+}
+
+static void
+free_flow_fields(void)
+{
+	int i;
+
+	for (i = 0; i < s_num_fields; ++i) {
+		free(s_flow_fields[i]->dists);
+		free(s_flow_fields[i]);
+	}
+	free(s_flow_fields);
+	free(s_flow_open);
+	s_flow_fields = NULL; s_flow_open = NULL;
+	s_num_fields = s_max_fields = 0;
+	s_num_flow_open = s_max_flow_open = 0;
+}
+
+static struct flow_field*
+get_flow_field(int layer, double x, double y)
+{
+	// returns the integration field for the tile containing (x, y), building it if it's
+	// not cached.  fields nobody is following stay cached so that persons sent to the
+	// same spot later can reuse them; once the cache is full, the least recently used
+	// of those is thrown out.
+	
+	struct flow_field* field;
+	int                goal;
+	int                goal_x, goal_y;
+	bool               is_repeating;
+	int                layer_w, layer_h;
+	struct flow_field* *new_fields;
+	int                new_size;
+	int                oldest = -1;
+	int                tile_w, tile_h;
+
+	int i;
+
+	if (get_map_walkmap(layer, &layer_w, &layer_h, &is_repeating) == NULL)
+		return NULL;
+	get_tile_size(get_map_tileset(), &tile_w, &tile_h);
+	goal_x = floor(x / tile_w);
+	goal_y = floor(y / tile_h);
+	if (is_repeating) {
+		goal_x = (goal_x % layer_w + layer_w) % layer_w;
+		goal_y = (goal_y % layer_h + layer_h) % layer_h;
+	}
+	else if (goal_x < 0 || goal_y < 0 || goal_x >= layer_w || goal_y >= layer_h)
+		return NULL;
+	goal = goal_x + goal_y * layer_w;
+	for (i = 0; i < s_num_fields; ++i) {
+		field = s_flow_fields[i];
+		if (field->layer == layer && field->goal == goal) {
+			field->last_used = ++s_flow_clock;
+			return field;
+		}
+	}
+	
+	// not cached, integrate a new field outward from the goal
+	if (!(field = calloc(1, sizeof(struct flow_field))))
+		return NULL;
+	field->layer = layer;
+	field->width = layer_w;
+	field->height = layer_h;
+	field->is_repeating = is_repeating;
+	field->goal = goal;
+	if (!(field->dists = malloc(layer_w * layer_h * sizeof(uint32_t))))
+		goto on_error;
+	memset(field->dists, 0xFF, layer_w * layer_h * sizeof(uint32_t));
+	field->dists[goal] = 0;
+	s_num_flow_open = 0;
+	if (!push_flow_node(0, goal))
+		goto on_error;
+	propagate_flow_field(field);
+	
+	// make room in the cache
+	if (s_num_fields >= FLOW_FIELD_CACHE) {
+		for (i = 0; i < s_num_fields; ++i) {
+			if (s_flow_fields[i]->refcount == 0
+				&& (oldest < 0 || s_flow_fields[i]->last_used < s_flow_fields[oldest]->last_used))
+			{
+				oldest = i;
+			}
+		}
+		if (oldest >= 0) {
+			free(s_flow_fields[oldest]->dists);
+			free(s_flow_fields[oldest]);
+			s_flow_fields[oldest] = s_flow_fields[--s_num_fields];
+		}
+	}
+	if (s_num_fields >= s_max_fields) {
+		new_size = s_max_fields > 0 ? s_max_fields * 2 : FLOW_FIELD_CACHE;
+		if (!(new_fields = realloc(s_flow_fields, new_size * sizeof(struct flow_field*))))
+			goto on_error;
+		s_flow_fields = new_fields;
+		s_max_fields = new_size;
+	}
+	s_flow_fields[s_num_fields++] = field;
+	field->last_used = ++s_flow_clock;
+	return field;
+
+on_error:
+	free(field->dists);
+	free(field);
+	return NULL;
+}
+
+static int
+get_flow_neighbor(const struct flow_field* field, int cell, int direction)
+{
+	static const int DX[4] = { 0, 1, 0, -1 };
+	static const int DY[4] = { -1, 0, 1, 0 };
+	
+	int x, y;
+
+	x = cell % field->width + DX[direction];
+	y = cell / field->width + DY[direction];
+	if (field->is_repeating) {
+		x = (x + field->width) % field->width;
+		y = (y + field->height) % field->height;
+	}
+	else if (x < 0 || y < 0 || x >= field->width || y >= field->height)
+		return -1;
+	return x + y * field->width;
+}
+
+static bool
+grow_flow_open(void)
+{
+	struct path_node* new_open;
+	int               new_size;
+
+	if (s_num_flow_open < s_max_flow_open)
+		return true;
+	new_size = s_max_flow_open > 0 ? s_max_flow_open * 2 : 256;
+	if (!(new_open = realloc(s_flow_open, new_size * sizeof(struct path_node))))
+		return false;
+	s_flow_open = new_open;
+	s_max_flow_open = new_size;
+	return true;
+}
+
+static uint32_t
+min_flow_neighbor(const struct flow_field* field, int cell)
+{
+	// returns the distance to the goal through the cell's closest neighbor.  moves in
+	// the walkability grid are blocked both ways, so the cell's own bits tell which
+	// neighbors it can be reached from.
+	
+	uint32_t       best = FLOW_UNREACHED;
+	int            next;
+	const uint8_t* walkmap;
+
+	int i;
+
+	walkmap = get_map_walkmap(field->layer, NULL, NULL, NULL);
+	for (i = 0; i < 4; ++i) {
+		next = get_flow_neighbor(field, cell, i);
+		if (next < 0 || (walkmap[cell] & 1 << i))
+			continue;
+		if (field->dists[next] != FLOW_UNREACHED && field->dists[next] + 1 < best)
+			best = field->dists[next] + 1;
+	}
+	return best;
+}
+
+static bool
+pop_flow_node(struct path_node* out_node)
+{
+	struct path_node last;
+	
+	int child, parent;
+
+	if (s_num_flow_open == 0)
+		return false;
+	*out_node = s_flow_open[0];
+	last = s_flow_open[--s_num_flow_open];
+	for (parent = 0; (child = parent * 2 + 1) < s_num_flow_open; parent = child) {
+		if (child + 1 < s_num_flow_open && is_node_before(&s_flow_open[child + 1], &s_flow_open[child]))
+			++child;
+		if (!is_node_before(&s_flow_open[child], &last))
+			break;
+		s_flow_open[parent] = s_flow_open[child];
+	}
+	if (s_num_flow_open > 0)
+		s_flow_open[parent] = last;
+	return true;
+}
+
+static void
+propagate_flow_field(struct flow_field* field)
+{
+	// spreads distances outward from the cells in the flow heap.  every step costs the
+	// same, but after a repair the heap is seeded with cells at different distances,
+	// so this needs to be Dijkstra rather than a plain breadth-first fill.
+	
+	struct path_node node;
+	int              next;
+	const uint8_t*   walkmap;
+
+	int i;
+
+	walkmap = get_map_walkmap(field->layer, NULL, NULL, NULL);
+	while (pop_flow_node(&node)) {
+		if (node.f > field->dists[node.cell])
+			continue;  // stale entry, cell was reached more cheaply since
+		for (i = 0; i < 4; ++i) {
+			next = get_flow_neighbor(field, node.cell, i);
+			if (next < 0 || (walkmap[node.cell] & 1 << i) || node.f + 1 >= field->dists[next])
+				continue;
+			field->dists[next] = node.f + 1;
+			if (!push_flow_node(node.f + 1, next)) {
+				s_num_flow_open = 0;
+				return;
+			}
+		}
+	}
+}
+
+static bool
+push_flow_node(uint32_t dist, int cell)
+{
+	struct path_node node;
+	
+	int child, parent;
+
+	if (!grow_flow_open())
+		return false;
+	node.cell = cell;
+	node.f = dist;
+	node.h = 0;
+	for (child = s_num_flow_open++; child > 0; child = parent) {
+		parent = (child - 1) / 2;
+		if (!is_node_before(&node, &s_flow_open[parent]))
+			break;
+		s_flow_open[child] = s_flow_open[parent];
+	}
+	s_flow_open[child] = node;
+	return true;
+}
+
+static void
+release_flow_field(struct flow_field* field)
+{
+	// the field itself stays cached until get_flow_field() needs the room
+	
+	if (field != NULL)
+		--field->refcount;
+}
+
+static void
+repair_flow_field(struct flow_field* field, int cell)
+{
+	// brings a field up to date after the tile at 'cell' changed.  a tile only affects
+	// moves across its own four edges, so any of those may have been blocked or opened.
+	// every cell that got its distance by way of the tile or one of its neighbors is
+	// wiped, and the wiped region is then refilled from the cells bordering it.
+	// distances outside the region stay valid, and an opened edge can only shorten
+	// them, which propagate_flow_field() takes care of.
+	
+	uint32_t         best;
+	struct path_node node;
+	int              next;
+	int              num_cleared;
+	int              seed;
+
+	int i, j;
+
+	// gather the cells downstream of the tile and its neighbors, using the heap array
+	// as a plain list for now.  each entry remembers the cell's old distance.
+	s_num_flow_open = 0;
+	for (i = -1; i < 4; ++i) {
+		seed = i < 0 ? cell : get_flow_neighbor(field, cell, i);
+		if (seed < 0 || seed == field->goal)
+			continue;  // the goal is always distance 0
+		for (j = 0; j < s_num_flow_open; ++j) {
+			if (s_flow_open[j].cell == seed) break;
+		}
+		if (j < s_num_flow_open)
+			continue;  // on a tiny repeating layer, neighbors can be the same cell
+		if (!grow_flow_open())
+			goto on_error;
+		s_flow_open[s_num_flow_open].cell = seed;
+		s_flow_open[s_num_flow_open].f = field->dists[seed];
+		s_flow_open[s_num_flow_open].h = 0;
+		++s_num_flow_open;
+		field->dists[seed] = FLOW_UNREACHED;
+	}
+	for (j = 0; j < s_num_flow_open; ++j) {
+		node = s_flow_open[j];
+		if (node.f == FLOW_UNREACHED)
+			continue;  // nothing was flowing through it
+		for (i = 0; i < 4; ++i) {
+			next = get_flow_neighbor(field, node.cell, i);
+			if (next < 0 || field->dists[next] != node.f + 1)
+				continue;
+			if (!grow_flow_open())
+				goto on_error;
+			s_flow_open[s_num_flow_open].cell = next;
+			s_flow_open[s_num_flow_open].f = field->dists[next];
+			s_flow_open[s_num_flow_open].h = 0;
+			++s_num_flow_open;
+			field->dists[next] = FLOW_UNREACHED;
+		}
+	}
+	
+	// reseed whatever can still reach the goal from outside the region.  a sorted array
+	// is already a valid heap, so that's all propagate_flow_field() needs.
+	num_cleared = s_num_flow_open;
+	s_num_flow_open = 0;
+	for (j = 0; j < num_cleared; ++j) {
+		node = s_flow_open[j];
+		if ((best = min_flow_neighbor(field, node.cell)) == FLOW_UNREACHED)
+			continue;
+		field->dists[node.cell] = best;
+		node.f = best;
+		s_flow_open[s_num_flow_open++] = node;
+	}
+	qsort(s_flow_open, s_num_flow_open, sizeof(struct path_node), compare_flow_nodes);
+	propagate_flow_field(field);
+	return;
+
+on_error:
+	// out of memory partway through; rebuild the whole field rather than leave holes
+	memset(field->dists, 0xFF, field->width * field->height * sizeof(uint32_t));
+	field->dists[field->goal] = 0;
+	s_num_flow_open = 0;
+	push_flow_node(0, field->goal);
+	propagate_flow_field(field);
+}
+
+static int*
+get_path_commands(const person_t* person, const struct path_search* search, int* out_count)
+{
+	// converts a finished search into person commands: a FACE command whenever the
+	// direction changes, then enough MOVE commands at the person's current speed to
+	// cross each tile
+	
+	int*  commands = NULL;
+	int   cell;
+	int   direction;
+	int   dx, dy;
+	int   face_command;
+	int   last_direction = -1;
+	int   max_commands;
+	int   num_cells = 0;
+	int   num_commands = 0;
+	int   num_steps;
+	int*  path = NULL;
+	int   steps_x, steps_y;
+	int   tile_w, tile_h;
+
+	int i, j;
+
+	*out_count = 0;
+	if (!search->is_found)
+		return NULL;
+	for (cell = search->goal; cell != search->start; cell = search->parents[cell])
+		++num_cells;
+	if (!(path = malloc((num_cells + 1) * sizeof(int))))
+		goto on_error;
+	for (cell = search->goal, i = num_cells; i >= 0; cell = search->parents[cell], --i)
+		path[i] = cell;
+	get_tile_size(get_map_tileset(), &tile_w, &tile_h);
+	steps_x = ceil(tile_w / (s_hot.speed_x[person->slot] > 0.0 ? s_hot.speed_x[person->slot] : 1.0));
+	steps_y = ceil(tile_h / (s_hot.speed_y[person->slot] > 0.0 ? s_hot.speed_y[person->slot] : 1.0));
+	max_commands = num_cells * (1 + (steps_x > steps_y ? steps_x : steps_y));
+	if (!(commands = malloc((max_commands > 0 ? max_commands : 1) * sizeof(int))))  // start == goal gives no commands
+		goto on_error;
+	for (i = 0; i < num_cells; ++i) {
+		dx = path[i + 1] % search->width - path[i] % search->width;
+		dy = path[i + 1] / search->width - path[i] / search->width;
+		if (dx > 1 || dx < -1) dx = dx > 0 ? -1 : 1;  // wrapped around the map
+		if (dy > 1 || dy < -1) dy = dy > 0 ? -1 : 1;
+		direction = dy < 0 ? COMMAND_MOVE_NORTH : dx > 0 ? COMMAND_MOVE_EAST
+			: dy > 0 ? COMMAND_MOVE_SOUTH : COMMAND_MOVE_WEST;
+		face_command = direction == COMMAND_MOVE_NORTH ? COMMAND_FACE_NORTH
+			: direction == COMMAND_MOVE_EAST ? COMMAND_FACE_EAST
+			: direction == COMMAND_MOVE_SOUTH ? COMMAND_FACE_SOUTH
+			: COMMAND_FACE_WEST;
+		if (direction != last_direction)
+			commands[num_commands++] = face_command;
+		num_steps = dx != 0 ? steps_x : steps_y;
+		for (j = 0; j < num_steps; ++j)
+			commands[num_commands++] = direction;
+		last_direction = direction;
+	}
+	free(path);
+	*out_count = num_commands;
+	return commands;
+
+on_error:
+	free(path);
+	free(commands);
+	return NULL;
+}
+
+static bool
+is_node_before(const struct path_node* node, const struct path_node* other)
+{
+	// ties on f go to the node closer to the goal, which keeps A* from fanning out
+	// across open ground where many paths are equally short
+	
+	return node->f < other->f || (node->f == other->f && node->h < other->h);
+}
+
+static bool
+queue_path(person_t* person, const struct path_search* search, bool is_immediate)
+{
+	int* commands;
+	int  num_commands;
+
+	int i;
+
+	if (!(commands = get_path_commands(person, search, &num_commands)))
+		return false;
+	if (!reserve_commands(person, num_commands)) {
+		free(commands);
+		return false;
+	}
+	for (i = 0; i < num_commands; ++i)
+		queue_person_command(person, commands[i], is_immediate);
+	free(commands);
+	return true;
+}
+
+static bool
+step_path_search(struct path_search* search, int budget)
+{
+	// expands up to 'budget' nodes (all of them if budget <= 0) and returns true once
+	// the search is finished, successfully or not.  open list entries are never
+	// updated in place; a cell that's reached more cheaply is simply pushed again and
+	// stale entries are skipped when popped.
+	
+	static const int DX[4] = { 0, 1, 0, -1 };
+	static const int DY[4] = { -1, 0, 1, 0 };
+	
+	int              cell;
+	uint32_t         cost;
+	int              dist_x, dist_y;
+	int              goal_x, goal_y;
+	uint32_t         h;
+	struct path_node last;
+	struct path_node node;
+	struct path_node *new_open;
+	int              new_size;
+	int              next;
+	int              num_expanded = 0;
+	const uint8_t*   walkmap;
+	int              x, y;
+
+	int i, child, parent;
+
+	if (search->is_done)
+		return true;
+	walkmap = get_map_walkmap(search->layer, NULL, NULL, NULL);
+	goal_x = search->goal % search->width;
+	goal_y = search->goal / search->width;
+	while (search->num_open > 0 && search->nodes_left != 0 && (budget <= 0 || num_expanded++ < budget)) {
+		// pop the lowest-cost node off the heap
+		node = search->open[0];
+		last = search->open[--search->num_open];
+		for (parent = 0; (child = parent * 2 + 1) < search->num_open; parent = child) {
+			if (child + 1 < search->num_open && is_node_before(&search->open[child + 1], &search->open[child]))
+				++child;
+			if (!is_node_before(&search->open[child], &last))
+				break;
+			search->open[parent] = search->open[child];
+		}
+		if (search->num_open > 0)
+			search->open[parent] = last;
+		cell = node.cell;
+		if (search->closed[cell])
+			continue;
+		search->closed[cell] = 1;
+		if (search->nodes_left > 0) --search->nodes_left;
+		if (cell == search->goal) {
+			search->is_found = true;
+			break;
+		}
+		
+		// add the cell's neighbors to the open list
+		for (i = 0; i < 4; ++i) {
+			x = cell % search->width + DX[i];
+			y = cell / search->width + DY[i];
+			if (search->is_repeating) {
+				x = (x + search->width) % search->width;
+				y = (y + search->height) % search->height;
+			}
+			else if (x < 0 || y < 0 || x >= search->width || y >= search->height)
+				continue;
+			next = x + y * search->width;
+			cost = search->costs[cell] + 1;
+			if ((walkmap[cell] & 1 << i) || search->closed[next] || cost >= search->costs[next])
+				continue;
+			search->costs[next] = cost;
+			search->parents[next] = cell;
+			dist_x = abs(x - goal_x);
+			dist_y = abs(y - goal_y);
+			if (search->is_repeating) {
+				if (search->width - dist_x < dist_x) dist_x = search->width - dist_x;
+				if (search->height - dist_y < dist_y) dist_y = search->height - dist_y;
+			}
+			h = dist_x + dist_y;
+			if (search->num_open >= search->max_open) {
+				new_size = search->max_open * 2;
+				if (!(new_open = realloc(search->open, new_size * sizeof(struct path_node)))) {
+					search->num_open = 0;
+					break;
+				}
+				search->open = new_open;
+				search->max_open = new_size;
+			}
+			node.cell = next;
+			node.f = cost + h;
+			node.h = h;
+			for (child = search->num_open++; child > 0; child = parent) {
+				parent = (child - 1) / 2;
+				if (!is_node_before(&node, &search->open[parent]))
+					break;
+				search->open[child] = search->open[parent];
+			}
+			search->open[child] = node;
+		}
+	}
+	search->is_done = search->is_found || search->num_open == 0 || search->nodes_left == 0;
+	return search->is_done;
+}
+
+static person_t*
+alloc_person(void)
+{
+	// persons are pooled.  they're allocated in blocks that never move, and each one
+	// is tied for life to a slot in the parallel arrays holding its hot fields (see
+	// struct person_hot).  slots freed by free_person() are handed out again before
+	// anything new is allocated.
+	
+	bool*      new_bools;
+	double*    new_doubles;
+	int*       new_ints;
+	person_t** new_pools;
+	person_t** new_persons;
+	int        new_size;
+	person_t*  person;
+	int        slot;
+
+	if (s_hot.num_free > 0)
+		slot = s_hot.free_slots[--s_hot.num_free];
+	else {
+		if (s_hot.num_slots >= PERSON_MAX_SLOTS)
+			return NULL;
+		if (s_hot.num_slots >= s_hot.max_slots) {
+			new_size = s_hot.max_slots > 0 ? s_hot.max_slots * 2 : PERSON_POOL_SIZE;
+			if (!(new_ints = realloc(s_hot.free_slots, new_size * sizeof(int)))) return NULL;
+			s_hot.free_slots = new_ints;
+			if (!(new_ints = realloc(s_hot.generations, new_size * sizeof(int)))) return NULL;
+			s_hot.generations = new_ints;
+			if (!(new_persons = realloc(s_hot.persons, new_size * sizeof(person_t*)))) return NULL;
+			s_hot.persons = new_persons;
+			if (!(new_doubles = realloc(s_hot.x, new_size * sizeof(double)))) return NULL;
+			s_hot.x = new_doubles;
+			if (!(new_doubles = realloc(s_hot.y, new_size * sizeof(double)))) return NULL;
+			s_hot.y = new_doubles;
+			if (!(new_ints = realloc(s_hot.layer, new_size * sizeof(int)))) return NULL;
+			s_hot.layer = new_ints;
+			if (!(new_doubles = realloc(s_hot.speed_x, new_size * sizeof(double)))) return NULL;
+			s_hot.speed_x = new_doubles;
+			if (!(new_doubles = realloc(s_hot.speed_y, new_size * sizeof(double)))) return NULL;
+			s_hot.speed_y = new_doubles;
+			if (!(new_ints = realloc(s_hot.frame, new_size * sizeof(int)))) return NULL;
+			s_hot.frame = new_ints;
+			if (!(new_ints = realloc(s_hot.anim_frames, new_size * sizeof(int)))) return NULL;
+			s_hot.anim_frames = new_ints;
+			if (!(new_bools = realloc(s_hot.has_moved, new_size * sizeof(bool)))) return NULL;
+			s_hot.has_moved = new_bools;
+			s_hot.max_slots = new_size;
+		}
+		if (s_hot.num_slots % PERSON_POOL_SIZE == 0) {
+			if (!(new_pools = realloc(s_pools, (s_num_pools + 1) * sizeof(person_t*))))
+				return NULL;
+			s_pools = new_pools;
+			if (!(s_pools[s_num_pools] = malloc(PERSON_POOL_SIZE * sizeof(person_t))))
+				return NULL;
+			++s_num_pools;
+		}
+		slot = s_hot.num_slots++;
+		s_hot.generations[slot] = 1;
+	}
+	person = &s_pools[slot / PERSON_POOL_SIZE][slot % PERSON_POOL_SIZE];
+	memset(person, 0, sizeof(person_t));
+	person->slot = slot;
+	s_hot.persons[slot] = person;
+	s_hot.x[slot] = s_hot.y[slot] = 0.0;
+	s_hot.layer[slot] = 0;
+	s_hot.speed_x[slot] = s_hot.speed_y[slot] = 0.0;
+	s_hot.frame[slot] = 0;
+	s_hot.anim_frames[slot] = 0;
+	s_hot.has_moved[slot] = false;
+	return person;
+}
+
+static int
+compare_person_draws(const void* a, const void* b)
+{
+	const struct person_draw* draw1 = a;
+	const struct person_draw* draw2 = b;
+
+	// ties keep their original order, otherwise qsort() could make overlapping
+	// sprites flicker
+	if (draw1->y != draw2->y)
+		return draw1->y < draw2->y ? -1 : 1;
+	return draw1->order - draw2->order;
+}
+
 static int
 compare_persons(const void* a, const void* b)
 {
 	person_t* p1 = *(person_t**)a;
 	person_t* p2 = *(person_t**)b;
 
-	return (p1->y + p1->y_offset) - (p2->y + p2->y_offset);
+	return (s_hot.y[p1->slot] + p1->y_offset) - (s_hot.y[p2->slot] + p2->y_offset);
 }
 
 static void
 free_person(person_t* person)
 {
+	struct name_entry* entry;
+	
 	int i;
 
+	unindex_person(person);
+	
+	// if another person has the same name, find_person() should return them now
+	entry = &s_names[person->name_id];
+	if (person->name != NULL && entry->person == person) {
+		entry->person = NULL;
+		for (i = 0; i < s_num_persons; ++i) {
+			if (s_persons[i] != person && s_persons[i]->name_id == person->name_id) {
+				entry->person = s_persons[i];
+				break;
+			}
+		}
+	}
 	for (i = 0; i < PERSON_SCRIPT_MAX; ++i)
 		free_script(person->scripts[i]);
 	free_spriteset(person->sprite);
-	free(person->name);
+	free_path_search(person->path_search);
+	release_flow_field(person->flow_field);
+	free(person->commands);
 	free(person->direction);
-	free(person);
+	for (i = 0; i < person->num_ignores; ++i)
+		release_name(person->ignores[i]);
+	free(person->ignores);
+	free(person->ignore_bits);
+	if (person->name != NULL)
+		release_name(person->name_id);
+	
+	// return the person to the pool.  bumping the generation invalidates any
+	// outstanding handles; 0 is skipped so that no valid handle is ever 0.
+	s_hot.persons[person->slot] = NULL;
+	s_hot.generations[person->slot] = (s_hot.generations[person->slot] + 1) & 0xFFFF;
+	if (s_hot.generations[person->slot] == 0)
+		s_hot.generations[person->slot] = 1;
+	s_hot.free_slots[s_hot.num_free++] = person->slot;
+}
+
+static void
+unlist_person(person_t* person)
+{
+	// removes a person from s_persons by moving the last person into their place.
+	// the list gets re-sorted before anything depends on its order again.
+	
+	int index = person->list_index;
+
+	s_persons[index] = s_persons[--s_num_persons];
+	s_persons[index]->list_index = index;
+	s_need_sort = true;
+}
+
+static unsigned int
+hash_name(const char* name)
+{
+	unsigned int hash = 2166136261U;
+
+	for (; *name != '\0'; ++name)
+		hash = (hash ^ (unsigned char)*name) * 16777619U;
+	return hash;
+}
+
+static unsigned int
+hash_person_cell(int layer, int x, int y)
+{
+	return ((unsigned int)layer * 83492791U ^ (unsigned int)x * 73856093U
+		^ (unsigned int)y * 19349663U) & (PERSON_BUCKETS - 1);
+}
+
+static void
+index_person(person_t* person)
+{
+	// files a person in the spatial hash under every cell its base overlaps. this is
+	// cheap to call after any change: if the person hasn't crossed into a different
+	// set of cells, nothing is done.
+	
+	struct person_bucket *bucket;
+	rect_t               base;
+	rect_t               cells;
+	person_t*            *new_list;
+	int                  new_size;
+
+	int x, y;
+
+	if (!is_map_engine_running()) {
+		// no map to normalize against; reset_persons() will catch us up later
+		unindex_person(person);
+		return;
+	}
+	base = get_person_base(person);
+	cells.x1 = floor((double)base.x1 / PERSON_CELL_SIZE);
+	cells.y1 = floor((double)base.y1 / PERSON_CELL_SIZE);
+	cells.x2 = floor((double)base.x2 / PERSON_CELL_SIZE);
+	cells.y2 = floor((double)base.y2 / PERSON_CELL_SIZE);
+	if (person->is_indexed && person->index_layer == s_hot.layer[person->slot]
+		&& memcmp(&cells, &person->index_cells, sizeof(rect_t)) == 0)
+	{
+		return;
+	}
+	unindex_person(person);
+	for (y = cells.y1; y <= cells.y2; ++y) for (x = cells.x1; x <= cells.x2; ++x) {
+		bucket = &s_buckets[hash_person_cell(s_hot.layer[person->slot], x, y)];
+		if (bucket->num_persons + 1 > bucket->max_persons) {
+			new_size = (bucket->num_persons + 1) * 2;
+			if (!(new_list = realloc(bucket->persons, new_size * sizeof(person_t*))))
+				continue;
+			bucket->persons = new_list;
+			bucket->max_persons = new_size;
+		}
+		bucket->persons[bucket->num_persons++] = person;
+	}
+	person->index_cells = cells;
+	person->index_layer = s_hot.layer[person->slot];
+	person->is_indexed = true;
+}
+
+static int
+intern_name(const char* name, bool want_create)
+{
+	// maps a person name to a small integer ID, assigning a new one if needed.  when
+	// want_create is true the caller also gets a reference to the ID, which must be
+	// dropped with release_name() later.  persons hold a reference to their own name
+	// and ignore lists hold one for each name on them, so an ID can't be reused while
+	// any ignore bitset still has its bit set.
+	
+	struct name_entry *entry;
+	unsigned int      hash;
+	int               name_id;
+	int               *new_free;
+	int               *new_hash;
+	struct name_entry *new_names;
+	int               new_size;
+	int               slot;
+
+	int i;
+
+	hash = hash_name(name);
+	if (s_name_hash_size > 0) {
+		slot = hash & (s_name_hash_size - 1);
+		for (; s_name_hash[slot] != 0; slot = (slot + 1) & (s_name_hash_size - 1)) {
+			entry = &s_names[s_name_hash[slot] - 1];
+			if (entry->hash == hash && strcmp(entry->name, name) == 0) {
+				if (want_create)
+					++entry->refcount;
+				return s_name_hash[slot] - 1;
+			}
+		}
+	}
+	if (!want_create)
+		return -1;
+	if (s_num_free_names == 0 && s_num_names + 1 > s_max_names) {
+		new_size = (s_num_names + 1) * 2;
+		if (!(new_names = realloc(s_names, new_size * sizeof(struct name_entry))))
+			return -1;
+		s_names = new_names;
+		if (!(new_free = realloc(s_free_names, new_size * sizeof(int))))
+			return -1;
+		s_free_names = new_free;
+		s_max_names = new_size;
+	}
+	if ((s_num_names + 1) * 2 > s_name_hash_size) {
+		new_size = s_name_hash_size > 0 ? s_name_hash_size * 2 : 64;
+		if (!(new_hash = calloc(new_size, sizeof(int))))
+			return -1;
+		for (i = 0; i < s_num_names; ++i) {
+			if (s_names[i].name == NULL)
+				continue;  // released
+			slot = s_names[i].hash & (new_size - 1);
+			while (new_hash[slot] != 0)
+				slot = (slot + 1) & (new_size - 1);
+			new_hash[slot] = i + 1;
+		}
+		free(s_name_hash);
+		s_name_hash = new_hash;
+		s_name_hash_size = new_size;
+	}
+	
+	// reuse released IDs first, which keeps the ignore bitsets small
+	name_id = s_num_free_names > 0 ? s_free_names[s_num_free_names - 1] : s_num_names;
+	entry = &s_names[name_id];
+	if (!(entry->name = strdup(name)))
+		return -1;
+	if (s_num_free_names > 0)
+		--s_num_free_names;
+	else
+		++s_num_names;
+	entry->hash = hash;
+	entry->person = NULL;
+	entry->refcount = 1;
+	slot = hash & (s_name_hash_size - 1);
+	while (s_name_hash[slot] != 0)
+		slot = (slot + 1) & (s_name_hash_size - 1);
+	s_name_hash[slot] = name_id + 1;
+	return name_id;
+}
+
+static bool
+reserve_commands(person_t* person, int count)
+{
+	// makes room for 'count' more commands in a person's queue.  the queue is a ring
+	// buffer; when it grows, the live commands are unwrapped into the new buffer.
+	
+	struct command* new_buffer;
+	int             new_size;
+
+	int i;
+
+	if (person->num_commands + count <= person->max_commands)
+		return true;
+	new_size = person->max_commands > 0 ? person->max_commands : 8;
+	while (new_size < person->num_commands + count)
+		new_size *= 2;
+	if (!(new_buffer = malloc(new_size * sizeof(struct command))))
+		return false;
+	for (i = 0; i < person->num_commands; ++i)
+		new_buffer[i] = person->commands[(person->first_command + i) % person->max_commands];
+	free(person->commands);
+	person->commands = new_buffer;
+	person->max_commands = new_size;
+	person->first_command = 0;
+	return true;
+}
+
+static void
+release_name(int name_id)
+{
+	// drops a reference to a name ID.  once nothing refers to it, the name is taken
+	// out of the hash table and its ID goes on the free list for intern_name() to
+	// hand out again.
+	
+	struct name_entry* entry;
+	unsigned int       home;
+	int                hole;
+	int                mask;
+	int                slot;
+
+	entry = &s_names[name_id];
+	if (--entry->refcount > 0)
+		return;
+	mask = s_name_hash_size - 1;
+	for (slot = entry->hash & mask; s_name_hash[slot] != name_id + 1; slot = (slot + 1) & mask);
+	
+	// linear probing: close the gap by shifting back any later entries in the run
+	// which would otherwise become unreachable
+	hole = slot;
+	for (slot = (slot + 1) & mask; s_name_hash[slot] != 0; slot = (slot + 1) & mask) {
+		home = s_names[s_name_hash[slot] - 1].hash & mask;
+		if (hole < slot ? (home > hole && home <= slot) : (home > hole || home <= slot))
+			continue;
+		s_name_hash[hole] = s_name_hash[slot];
+		hole = slot;
+	}
+	s_name_hash[hole] = 0;
+	free(entry->name);
+	entry->name = NULL;
+	entry->person = NULL;
+	s_free_names[s_num_free_names++] = name_id;
+}
+
+static bool
+is_ignoring_id(const person_t* person, int name_id)
+{
+	return name_id / 32 < person->ignore_words
+		&& (person->ignore_bits[name_id / 32] & (1U << (name_id % 32))) != 0;
+}
+
+static void
+unindex_person(person_t* person)
+{
+	struct person_bucket *bucket;
+
+	int i, x, y;
+
+	if (!person->is_indexed)
+		return;
+	for (y = person->index_cells.y1; y <= person->index_cells.y2; ++y)
+	for (x = person->index_cells.x1; x <= person->index_cells.x2; ++x) {
+		bucket = &s_buckets[hash_person_cell(person->index_layer, x, y)];
+		for (i = 0; i < bucket->num_persons; ++i) {
+			if (bucket->persons[i] == person) {
+				bucket->persons[i] = bucket->persons[--bucket->num_persons];
+				break;
+			}
+		}
+	}
+	person->is_indexed = false;
 }
 
 static void
 set_person_direction(person_t* person, const char* direction)
 {
+	// the name is kept for the JS API, but rendering and animation only use the
+	// resolved pose index.  talk_person() uses the precomputed facing vector.
+	
+	person->face_command = -1;
+	if (person->direction != NULL && strcmp(direction, person->direction) == 0)
+		return;
 	person->direction = realloc(person->direction, (strlen(direction) + 1) * sizeof(char));
 	strcpy(person->direction, direction);
+	person->pose_index = get_sprite_pose_index(person->sprite, direction);
+	person->facing_x = (strstr(direction, "east") != NULL) - (strstr(direction, "west") != NULL);
+	person->facing_y = (strstr(direction, "south") != NULL) - (strstr(direction, "north") != NULL);
 }
 
 static void
 set_person_name(person_t* person, const char* name)
 {
-	person->name = realloc(person->name, (strlen(name) + 1) * sizeof(char));
-	strcpy(person->name, name);
+	struct name_entry* entry;
+	int                name_id;
+
+	if ((name_id = intern_name(name, true)) < 0)
+		return;
+	entry = &s_names[name_id];
+	person->name_id = name_id;
+	person->name = entry->name;
+	if (entry->person == NULL)
+		entry->person = person;
 }
 
 static void
@@ -740,59 +2136,46 @@ command_person(person_t* person, int command)
 	double    new_x, new_y;
 	person_t* person_to_touch;
 
-	new_x = person->x; new_y = person->y;
+	new_x = s_hot.x[person->slot]; new_y = s_hot.y[person->slot];
 	switch (command) {
 	case COMMAND_ANIMATE:
-		if (person->anim_frames > 0 && --person->anim_frames == 0) {
-			++person->frame;
-			person->anim_frames = get_sprite_frame_delay(person->sprite, person->direction, person->frame);
+		if (s_hot.anim_frames[person->slot] > 0 && --s_hot.anim_frames[person->slot] == 0) {
+			++s_hot.frame[person->slot];
+			s_hot.anim_frames[person->slot] = get_sprite_frame_delay(person->sprite, person->pose_index, s_hot.frame[person->slot]);
 		}
 		break;
-	case COMMAND_FACE_NORTH:
-		set_person_direction(person, "north");
-		break;
-	case COMMAND_FACE_NORTHEAST:
-		set_person_direction(person, "northeast");
-		break;
-	case COMMAND_FACE_EAST:
-		set_person_direction(person, "east");
-		break;
-	case COMMAND_FACE_SOUTHEAST:
-		set_person_direction(person, "southeast");
-		break;
-	case COMMAND_FACE_SOUTH:
-		set_person_direction(person, "south");
-		break;
-	case COMMAND_FACE_SOUTHWEST:
-		set_person_direction(person, "southwest");
-		break;
-	case COMMAND_FACE_WEST:
-		set_person_direction(person, "west");
-		break;
-	case COMMAND_FACE_NORTHWEST:
-		set_person_direction(person, "northwest");
+	case COMMAND_FACE_NORTH: case COMMAND_FACE_NORTHEAST:
+	case COMMAND_FACE_EAST: case COMMAND_FACE_SOUTHEAST:
+	case COMMAND_FACE_SOUTH: case COMMAND_FACE_SOUTHWEST:
+	case COMMAND_FACE_WEST: case COMMAND_FACE_NORTHWEST:
+		// facing commands are queued every step, so skip them if nothing changes
+		if (command != person->face_command) {
+			set_person_direction(person, FACE_NAMES[command - COMMAND_FACE_NORTH]);
+			person->face_command = command;
+		}
 		break;
 	case COMMAND_MOVE_NORTH:
-		new_y = person->y - person->speed_y;
+		new_y = s_hot.y[person->slot] - s_hot.speed_y[person->slot];
 		break;
 	case COMMAND_MOVE_EAST:
-		new_x = person->x + person->speed_x;
+		new_x = s_hot.x[person->slot] + s_hot.speed_x[person->slot];
 		break;
 	case COMMAND_MOVE_SOUTH:
-		new_y = person->y + person->speed_y;
+		new_y = s_hot.y[person->slot] + s_hot.speed_y[person->slot];
 		break;
 	case COMMAND_MOVE_WEST:
-		new_x = person->x - person->speed_x;
+		new_x = s_hot.x[person->slot] - s_hot.speed_x[person->slot];
 		break;
 	}
-	if (new_x != person->x || new_y != person->y) {
+	if (new_x != s_hot.x[person->slot] || new_y != s_hot.y[person->slot]) {
 		// person is trying to move, make sure the path is clear of obstructions
 		if (!is_person_obstructed_at(person, new_x, new_y, &person_to_touch, NULL)) {
 			command_person(person, COMMAND_ANIMATE);
-			person->x = new_x; person->y = new_y;
+			s_hot.x[person->slot] = new_x; s_hot.y[person->slot] = new_y;
+			index_person(person);
 			person->revert_frames = person->revert_delay;
-			person->has_moved = true;
-			sort_persons();
+			s_hot.has_moved[person->slot] = true;
+			s_need_sort = true;
 		}
 		else {
 			// if not, and we collided with a person, call that person's touch script
@@ -805,7 +2188,117 @@ command_person(person_t* person, int command)
 static void
 sort_persons(void)
 {
-	qsort(s_persons, s_num_persons, sizeof(person_t*), compare_persons);
+	// persons only ever move a few pixels at a time, so the list is nearly sorted
+	// and an insertion sort finishes in close to linear time.  sorting is deferred
+	// until the order is actually needed, at most once per frame.  the per-layer
+	// lists used by render_persons() are rebuilt here as well, in sorted order.
+	
+	struct person_bucket* list;
+	struct person_bucket* new_lists;
+	person_t*             *new_persons;
+	int                   new_size;
+	person_t*             person;
+	
+	int i, j;
+
+	if (!s_need_sort)
+		return;
+	for (i = 1; i < s_num_persons; ++i) {
+		person = s_persons[i];
+		for (j = i; j > 0 && compare_persons(&s_persons[j - 1], &person) > 0; --j)
+			s_persons[j] = s_persons[j - 1];
+		s_persons[j] = person;
+	}
+	for (i = 0; i < s_num_persons; ++i)
+		s_persons[i]->list_index = i;
+	for (i = 0; i < s_num_lists; ++i)
+		s_layer_lists[i].num_persons = 0;
+	for (i = 0; i < s_num_persons; ++i) {
+		person = s_persons[i];
+		if (s_hot.layer[person->slot] >= s_num_lists) {
+			new_size = s_hot.layer[person->slot] + 1;
+			if (!(new_lists = realloc(s_layer_lists, new_size * sizeof(struct person_bucket))))
+				continue;
+			memset(&new_lists[s_num_lists], 0, (new_size - s_num_lists) * sizeof(struct person_bucket));
+			s_layer_lists = new_lists;
+			s_num_lists = new_size;
+		}
+		list = &s_layer_lists[s_hot.layer[person->slot]];
+		if (list->num_persons >= list->max_persons) {
+			new_size = list->max_persons > 0 ? list->max_persons * 2 : 8;
+			if (!(new_persons = realloc(list->persons, new_size * sizeof(person_t*))))
+				continue;
+			list->persons = new_persons;
+			list->max_persons = new_size;
+		}
+		list->persons[list->num_persons++] = person;
+	}
+	s_need_sort = false;
+}
+
+static void
+update_person(person_t* person)
+{
+	struct command  command;
+	person_handle_t handle;
+	bool            is_finished;
+	person_handle_t last_person;
+
+	handle = get_person_handle(person);
+	if (person->revert_delay > 0 && --person->revert_frames <= 0)
+		s_hot.frame[person->slot] = 0;
+	
+	// advance any pathfinding in progress; the path is queued once it's found
+	if (person->path_search != NULL
+		&& step_path_search(person->path_search, person->path_search->budget))
+	{
+		queue_path(person, person->path_search, person->path_search->is_immediate);
+		free_path_search(person->path_search);
+		person->path_search = NULL;
+	}
+	if (person->num_commands == 0 && person->flow_field != NULL)
+		follow_flow_field(person);
+	if (person->num_commands == 0 && person->path_search == NULL && person->flow_field == NULL) {
+		call_person_script(person, PERSON_SCRIPT_GENERATOR, true);
+		if (resolve_person_handle(handle) != person)
+			return;  // destroyed by its own command generator
+	}
+	
+	// run through the command queue, stopping after the first non-immediate command
+	is_finished = person->num_commands == 0;
+	while (!is_finished) {
+		command = person->commands[person->first_command];
+		person->first_command = (person->first_command + 1) % person->max_commands;
+		--person->num_commands;
+		last_person = s_current_person;
+		s_current_person = handle;
+		if (command.type != COMMAND_RUN_SCRIPT)
+			command_person(person, command.type);
+		else
+			run_script(command.script_id, false);
+		s_current_person = last_person;
+		free_script(command.script_id);
+		if (resolve_person_handle(handle) != person)
+			break;
+		is_finished = !command.is_immediate || person->num_commands == 0;
+	}
+}
+
+static duk_ret_t
+update_person_list(duk_context* ctx)
+{
+	int base = duk_require_int(ctx, 0);
+	int count = duk_require_int(ctx, 1);
+
+	person_t* person;
+	
+	int i;
+
+	for (i = base; i < base + count; ++i) {
+		if ((person = resolve_person_handle(s_updates[i])) != NULL)
+			update_person(person);
+	}
+	return 0;
 }
 
 static duk_ret_t
@@ -818,7 +2311,8 @@ js_CreatePerson(duk_context* ctx)
 	name = duk_require_string(ctx, 0);
 	sprite_file = duk_require_string(ctx, 1);
 	destroy_with_map = duk_require_boolean(ctx, 2);
-	create_person(name, sprite_file, !destroy_with_map);
+	if (!create_person(name, sprite_file, !destroy_with_map))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "CreatePerson(): Failed to create person '%s' (internal error)", name);
 	duk_push_global_stash(ctx);
 	duk_get_prop_string(ctx, -1, "person_data");
 	duk_push_object(ctx); duk_put_prop_string(ctx, -2, name);
@@ -887,6 +2381,32 @@ js_DoesPersonExist(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_IsPersonFindingPath(duk_context* ctx)
+{
+	const char* name = duk_require_string(ctx, 0);
+
+	person_t* person;
+
+	if ((person = find_person(name)) == NULL)
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "IsPersonFindingPath(): Person '%s' doesn't exist", name);
+	duk_push_boolean(ctx, person->path_search != NULL);
+	return 1;
+}
+
+static duk_ret_t
+js_IsPersonFollowingFlowField(duk_context* ctx)
+{
+	const char* name = duk_require_string(ctx, 0);
+
+	person_t* person;
+
+	if ((person = find_person(name)) == NULL)
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "IsPersonFollowingFlowField(): Person '%s' doesn't exist", name);
+	duk_push_boolean(ctx, person->flow_field != NULL);
+	return 1;
+}
+
 static duk_ret_t
 js_IsPersonObstructed(duk_context* ctx)
 {
@@ -915,12 +2435,123 @@ js_IsPersonVisible(duk_context* ctx)
 	return 1;
 }
 
+static duk_ret_t
+js_FindPath(duk_context* ctx)
+{
+	// FindPath(name, x, y[, options])
+	// finds a path for a person to (x, y) over the tile grid of their layer.  by default,
+	// returns the path as an array of commands (or null if there is none).  options:
+	//     queue:     if true, queue the path onto the person instead
+	//     immediate: queue the commands as immediate
+	//     max_nodes: give up after searching this many tiles
+	//     budget:    search at most this many tiles per frame, queuing the path when
+	//                it's found.  returns right away; see IsPersonFindingPath().
+	// note: the search only checks the line between tile centers against obstructions.
+	// it doesn't account for the size of the person's base or for other persons, so a
+	// path can lead through a gap the person is too wide for.  the queued moves then
+	// stall at the gap without any error, the same as any other obstructed move.
+	
+	int n_args = duk_get_top(ctx);
+	const char* name = duk_require_string(ctx, 0);
+	double x = duk_require_number(ctx, 1);
+	double y = duk_require_number(ctx, 2);
+
+	int                budget = 0;
+	int*               commands;
+	bool               is_immediate = false;
+	bool               is_queued = false;
+	int                max_nodes = 0;
+	int                num_commands;
+	person_t*          person;
+	struct path_search *search;
+
+	int i;
+
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "FindPath(): Map engine must be running");
+	if ((person = find_person(name)) == NULL)
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "FindPath(): Person '%s' doesn't exist", name);
+	if (n_args >= 4) {
+		duk_require_object_coercible(ctx, 3);
+		duk_get_prop_string(ctx, 3, "queue"); is_queued = duk_to_boolean(ctx, -1); duk_pop(ctx);
+		duk_get_prop_string(ctx, 3, "immediate"); is_immediate = duk_to_boolean(ctx, -1); duk_pop(ctx);
+		duk_get_prop_string(ctx, 3, "max_nodes"); max_nodes = duk_to_int(ctx, -1); duk_pop(ctx);
+		duk_get_prop_string(ctx, 3, "budget"); budget = duk_to_int(ctx, -1); duk_pop(ctx);
+	}
+	if (!(search = begin_path_search(person, x, y, max_nodes)))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "FindPath(): Failed to start path search (internal error)");
+	if (budget > 0) {
+		// incremental search, continued by update_persons()
+		search->budget = budget;
+		search->is_immediate = is_immediate;
+		free_path_search(person->path_search);
+		person->path_search = search;
+		duk_push_true(ctx);
+		return 1;
+	}
+	step_path_search(search, 0);
+	if (is_queued) {
+		duk_push_boolean(ctx, queue_path(person, search, is_immediate));
+		free_path_search(search);
+		return 1;
+	}
+	commands = get_path_commands(person, search, &num_commands);
+	free_path_search(search);
+	if (commands == NULL) {
+		duk_push_null(ctx);
+		return 1;
+	}
+	duk_push_array(ctx);
+	for (i = 0; i < num_commands; ++i) {
+		duk_push_int(ctx, commands[i]);
+		duk_put_prop_index(ctx, -2, i);
+	}
+	free(commands);
+	return 1;
+}
+
+static duk_ret_t
+js_FollowFlowField(duk_context* ctx)
+{
+	// FollowFlowField(name, x, y)
+	// sends a person toward (x, y) by following a flow field over their layer's tile
+	// grid.  every person sent to the same tile shares one field, so this scales to
+	// any number of followers.  the person keeps following until they arrive or
+	// ClearPersonCommands() is called.  returns false if the tile is off the map.
+	// like FindPath(), the field ignores the size of the person's base.
+	
+	const char* name = duk_require_string(ctx, 0);
+	double x = duk_require_number(ctx, 1);
+	double y = duk_require_number(ctx, 2);
+
+	struct flow_field* field;
+	person_t*          person;
+
+	if (!is_map_engine_running())
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "FollowFlowField(): Map engine must be running");
+	if ((person = find_person(name)) == NULL)
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "FollowFlowField(): Person '%s' doesn't exist", name);
+	if (!(field = get_flow_field(s_hot.layer[person->slot], x, y))) {
+		duk_push_false(ctx);
+		return 1;
+	}
+	++field->refcount;
+	release_flow_field(person->flow_field);
+	person->flow_field = field;
+	free_path_search(person->path_search);
+	person->path_search = NULL;
+	duk_push_true(ctx);
+	return 1;
+}
+
 static duk_ret_t
 js_GetCurrentPerson(duk_context* ctx)
 {
-	if (s_current_person == NULL)
+	person_t* person;
+
+	if ((person = resolve_person_handle(s_current_person)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "GetCurrentPerson(): Must be called from a person script");
-	duk_push_string(ctx, s_current_person->name);
+	duk_push_string(ctx, person->name);
 	return 1;
 }
 
@@ -1058,7 +2689,7 @@ js_GetPersonFrame(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonFrame(): Person '%s' doesn't exist", name);
-	duk_push_int(ctx, person->frame);
+	duk_push_int(ctx, s_hot.frame[person->slot]);
 	return 0;
 }
 
@@ -1075,7 +2706,7 @@ js_GetPersonIgnoreList(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonIgnoreList(): Person '%s' doesn't exist", name);
 	duk_push_array(ctx);
 	for (i = 0; i < person->num_ignores; ++i) {
-		duk_push_string(ctx, person->ignores[i]);
+		duk_push_string(ctx, s_names[person->ignores[i]].name);
 		duk_put_prop_index(ctx, -2, i);
 	}
 	return 1;
@@ -1090,7 +2721,7 @@ js_GetPersonLayer(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonLayer(): Person '%s' doesn't exist", name);
-	duk_push_int(ctx, person->layer);
+	duk_push_int(ctx, s_hot.layer[person->slot]);
 	return 1;
 }
 
@@ -1138,6 +2769,7 @@ js_GetPersonList(duk_context* ctx)
 {
 	int i;
 	
+	sort_persons();
 	duk_push_array(ctx);
 	for (i = 0; i < s_num_persons; ++i) {
 		duk_push_string(ctx, s_persons[i]->name);
@@ -1220,7 +2852,7 @@ js_GetPersonX(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonX(): Person '%s' doesn't exist", name);
-	duk_push_int(ctx, person->x);
+	duk_push_int(ctx, s_hot.x[person->slot]);
 	return 1;
 }
 
@@ -1233,7 +2865,7 @@ js_GetPersonXFloat(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonXFloat(): Person '%s' doesn't exist", name);
-	duk_push_number(ctx, person->x);
+	duk_push_number(ctx, s_hot.x[person->slot]);
 	return 1;
 }
 
@@ -1246,7 +2878,7 @@ js_GetPersonY(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonY(): Person '%s' doesn't exist", name);
-	duk_push_int(ctx, person->y);
+	duk_push_int(ctx, s_hot.y[person->slot]);
 	return 1;
 }
 
@@ -1259,7 +2891,7 @@ js_GetPersonYFloat(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "GetPersonYFloat(): Person '%s' doesn't exist", name);
-	duk_push_number(ctx, person->y);
+	duk_push_number(ctx, s_hot.y[person->slot]);
 	return 1;
 }
 
@@ -1340,7 +2972,7 @@ js_SetPersonFrame(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonFrame(): Person '%s' doesn't exist", name);
 	if (frame_index < 0)
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetPersonFrame(): Invalid frame index or frame doesn't exist (caller passed %i)", frame_index);
-	person->frame = frame_index;
+	s_hot.frame[person->slot] = frame_index;
 	return 0;
 }
 
@@ -1366,8 +2998,12 @@ js_SetPersonIgnoreList(duk_context* ctx)
 	const char* name = duk_require_string(ctx, 0);
 	duk_require_object_coercible(ctx, 1);
 
+	uint32_t* bits;
+	int*      ids;
 	int       list_size;
+	int       max_id = -1;
 	person_t* person;
+	int       words;
 
 	int i;
 
@@ -1376,16 +3012,42 @@ js_SetPersonIgnoreList(duk_context* ctx)
 	if (!duk_is_array(ctx, 1))
 		duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "SetPersonIgnoreList(): ignore_list argument must be an array");
 	list_size = duk_get_length(ctx, 1);
-	for (i = 0; i < person->num_ignores; ++i) {
-		free(person->ignores[i]);
+	for (i = 0; i < list_size; ++i) {
+		duk_get_prop_index(ctx, 1, i);
+		duk_require_string(ctx, -1);
+		duk_pop(ctx);
 	}
-	person->ignores = realloc(person->ignores, list_size * sizeof(char*));
-	person->num_ignores = list_size;
+	if (!(ids = malloc((list_size + 1) * sizeof(int))))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetPersonIgnoreList(): Failed to allocate ignore list");
 	for (i = 0; i < list_size; ++i) {
 		duk_get_prop_index(ctx, 1, i);
-		person->ignores[i] = strdup(duk_require_string(ctx, -1));
+		ids[i] = intern_name(duk_get_string(ctx, -1), true);
 		duk_pop(ctx);
+		if (ids[i] < 0) {
+			while (--i >= 0) release_name(ids[i]);
+			free(ids);
+			duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetPersonIgnoreList(): Failed to allocate ignore list");
+		}
+		if (ids[i] > max_id) max_id = ids[i];
+	}
+	
+	// ignore tests are done against a bitset indexed by name ID
+	words = max_id / 32 + 1;
+	if (!(bits = calloc(words, sizeof(uint32_t)))) {
+		for (i = 0; i < list_size; ++i) release_name(ids[i]);
+		free(ids);
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetPersonIgnoreList(): Failed to allocate ignore list");
 	}
+	for (i = 0; i < list_size; ++i)
+		bits[ids[i] / 32] |= 1U << (ids[i] % 32);
+	for (i = 0; i < person->num_ignores; ++i)
+		release_name(person->ignores[i]);
+	free(person->ignores);
+	free(person->ignore_bits);
+	person->ignores = ids;
+	person->num_ignores = list_size;
+	person->ignore_bits = bits;
+	person->ignore_words = words;
 	return 0;
 }
 
@@ -1399,7 +3061,9 @@ js_SetPersonLayer(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonLayer(): Person '%s' doesn't exist", name);
-	person->layer = layer;
+	s_hot.layer[person->slot] = layer;
+	index_person(person);
+	s_need_sort = true;
 	return 0;
 }
 
@@ -1494,7 +3158,7 @@ js_SetPersonScript(duk_context* ctx)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonScript(): Person '%s' doesn't exist", name);
 	if (type < 0 || type >= PERSON_SCRIPT_MAX)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "SetPersonScript(): Invalid script type constant");
-	set_person_script(person, type, script);
+	set_person_script(person, type, script, false);
 	free_lstring(script);
 	return 0;
 }
@@ -1589,7 +3253,8 @@ js_SetPersonX(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonX(): Person '%s' doesn't exist", name);
-	person->x = x;
+	s_hot.x[person->slot] = x;
+	index_person(person);
 	return 0;
 }
 
@@ -1604,7 +3269,8 @@ js_SetPersonXYFloat(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonXYFloat(): Person '%s' doesn't exist", name);
-	person->x = x; person->y = y;
+	s_hot.x[person->slot] = x; s_hot.y[person->slot] = y;
+	index_person(person);
 	return 0;
 }
 
@@ -1618,7 +3284,8 @@ js_SetPersonY(duk_context* ctx)
 
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "SetPersonY(): Person '%s' doesn't exist", name);
-	person->y = y;
+	s_hot.y[person->slot] = y;
+	index_person(person);
 	return 0;
 }
 
@@ -1639,7 +3306,7 @@ js_CallDefaultPersonScript(duk_context* ctx)
 	const char* name = duk_require_string(ctx, 0);
 	int type = duk_require_int(ctx, 1);
 
-	const person_t* last_person;
+	person_handle_t last_person;
 	person_t*       person;
 
 	if ((person = find_person(name)) == NULL)
@@ -1647,7 +3314,7 @@ js_CallDefaultPersonScript(duk_context* ctx)
 	if (type < 0 || type >= PERSON_SCRIPT_MAX)
 		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "CallDefaultPersonScript(): Invalid script type constant");
 	last_person = s_current_person;
-	s_current_person = person;
+	s_current_person = get_person_handle(person);
 	run_script(s_def_scripts[type], false);
 	s_current_person = last_person;
 	return 0;
@@ -1679,6 +3346,11 @@ js_ClearPersonCommands(duk_context* ctx)
 	if ((person = find_person(name)) == NULL)
 		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "ClearPersonCommands(): Person '%s' doesn't exist", name);
 	person->num_commands = 0;
+	person->first_command = 0;
+	free_path_search(person->path_search);
+	person->path_search = NULL;
+	release_flow_field(person->flow_field);
+	person->flow_field = NULL;
 	return 0;
 }
 
@@ -1728,6 +3400,44 @@ js_QueuePersonCommand(duk_context* ctx)
 	return 0;
 }
 
+static duk_ret_t
+js_QueuePersonCommands(duk_context* ctx)
+{
+	int n_args = duk_get_top(ctx);
+	const char* name = duk_require_string(ctx, 0);
+	duk_require_object_coercible(ctx, 1);
+	bool is_immediate = n_args >= 3 ? duk_require_boolean(ctx, 2) : false;
+
+	int       command;
+	int       list_size;
+	person_t* person;
+
+	int i;
+
+	if (!(person = find_person(name)))
+		duk_error_ni(ctx, -1, DUK_ERR_REFERENCE_ERROR, "QueuePersonCommands(): Person '%s' doesn't exist", name);
+	if (!duk_is_array(ctx, 1))
+		duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "QueuePersonCommands(): commands argument must be an array");
+	
+	// validate the whole list up front so a bad entry doesn't leave it half-queued
+	list_size = duk_get_length(ctx, 1);
+	for (i = 0; i < list_size; ++i) {
+		duk_get_prop_index(ctx, 1, i);
+		command = duk_require_int(ctx, -1);
+		duk_pop(ctx);
+		if (command < 0 || command >= COMMAND_RUN_SCRIPT)
+			duk_error_ni(ctx, -1, DUK_ERR_RANGE_ERROR, "QueuePersonCommands(): Invalid command type constant at index %i", i);
+	}
+	if (!reserve_commands(person, list_size))
+		duk_error_ni(ctx, -1, DUK_ERR_ERROR, "QueuePersonCommands(): Failed to enlarge person's command queue (internal error)");
+	for (i = 0; i < list_size; ++i) {
+		duk_get_prop_index(ctx, 1, i);
+		queue_person_command(person, duk_get_int(ctx, -1), is_immediate);
+		duk_pop(ctx);
+	}
+	return 0;
+}
+
 static duk_ret_t
 js_QueuePersonScript(duk_context* ctx)
 {
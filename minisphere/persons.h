@@ -2,11 +2,14 @@
 #include "spriteset.h"
 
 typedef struct person person_t;
+typedef uint32_t      person_handle_t;
 
 extern void         initialize_persons_manager (void);
 extern void         shutdown_persons_manager   (void);
 extern person_t*    create_person              (const char* name, const char* sprite_file, bool is_persistent);
 extern void         destroy_person             (person_t* person);
+extern person_handle_t get_person_handle       (const person_t* person);
+extern person_t*    resolve_person_handle      (person_handle_t handle);
 extern bool         has_person_moved           (const person_t* person);
 extern bool         is_person_busy             (const person_t* person);
 extern bool         is_person_ignored          (const person_t* person, const person_t* by_person);
@@ -23,7 +26,7 @@ extern void         get_person_xyz             (const person_t* person, double*
 extern void         set_person_angle           (person_t* person, double theta);
 extern void         set_person_mask            (person_t* person, color_t mask);
 extern void         set_person_scale           (person_t*, double scale_x, double scale_y);
-extern bool         set_person_script          (person_t* person, int type, const lstring_t* script);
+extern bool         set_person_script          (person_t* person, int type, const lstring_t* script, bool is_deferred);
 extern void         set_person_speed           (person_t* person, double x_speed, double y_speed);
 extern void         set_person_spriteset       (person_t* person, spriteset_t* spriteset);
 extern void         set_person_xyz             (person_t* person, double x, double y, int layer);
@@ -31,7 +34,8 @@ extern bool         call_person_script         (const person_t* person, int type
 extern person_t*    find_person                (const char* name);
 extern bool         queue_person_command       (person_t* person, int command, bool is_immediate);
 extern void         reset_persons              (map_t* map, bool keep_existing);
-extern void         render_persons             (int layer, bool is_flipped, int cam_x, int cam_y);
+extern void         render_persons             (int layer, bool is_flipped, int cam_x, int cam_y, int wrap_w, int wrap_h);
+extern void         repair_flow_fields         (int layer, int x, int y);
 extern void         talk_person                (const person_t* person);
 extern void         update_persons             (void);
 
@@ -1,67 +1,363 @@
 #include "minisphere.h"
 
+struct script
+{
+	char*        name;
+	lstring_t*   source;
+	unsigned int hash;
+	int          hash_next;
+	void*        heapptr;
+	unsigned int idle_stamp;
+	bool         is_compiled;
+	int          refcount;
+};
+
+struct script_handle
+{
+	int  body_id;
+	bool is_in_use;
+};
+
+struct idle_script
+{
+	int          body_id;
+	unsigned int stamp;
+};
+
+static int          add_handle         (int body_id);
+static int          add_script         (const lstring_t* source, unsigned int hash, const char* name);
+static void         compile_entry      (int body_id);
+static void         destroy_script     (int body_id);
+static int          find_script        (const lstring_t* source, unsigned int hash);
+static unsigned int hash_source        (const lstring_t* source);
+static void         push_script_array  (void);
+static void         release_body       (int body_id);
+static void         store_function     (int body_id);
+
+static const int SCRIPT_BUCKETS  = 1024;
+static const int SCRIPT_IDLE_MAX = 256;
+
+static int                  *s_free_handles    = NULL;
+static struct script_handle *s_handles         = NULL;
+static int                  *s_hash_heads      = NULL;
+static struct idle_script   *s_idle            = NULL;
+static unsigned int         s_idle_clock       = 0;
+static int                  s_idle_head        = 0;
+static int                  *s_free_ids        = NULL;
+static int                  s_max_handles      = 0;
+static int                  s_max_scripts      = 0;
+static int                  s_num_free         = 0;
+static int                  s_num_free_handles = 0;
+static int                  s_num_handles      = 0;
+static int                  s_num_idle         = 0;
+static int                  s_num_scripts      = 0;
+static struct script        *s_scripts         = NULL;
+
 int
 compile_script(const lstring_t* script, const char* name)
 {
-	int index;
+	// scripts are cached by source text: compiling the same source twice shares one
+	// compiled body between both owners, but each still gets its own script ID and
+	// reentry flag.  the body is only let go once every owner has freed it.  the name
+	// used is whichever one the script was first compiled with.
 
-	duk_push_global_stash(g_duktape);
-	if (!duk_get_prop_string(g_duktape, -1, "scripts")) {
-		duk_pop(g_duktape);
-		duk_push_array(g_duktape); duk_put_prop_string(g_duktape, -2, "scripts");
-		duk_get_prop_string(g_duktape, -1, "scripts");
+	int          body_id;
+	unsigned int hash;
+	int          script_id;
+
+	hash = hash_source(script);
+	if ((body_id = find_script(script, hash)) > 0) {
+		if (!s_scripts[body_id - 1].is_compiled)
+			compile_entry(body_id);
+		++s_scripts[body_id - 1].refcount;
 	}
-	duk_get_prop_string(g_duktape, -1, "length"); index = duk_get_int(g_duktape, -1); duk_pop(g_duktape);
-	duk_push_string(g_duktape, name);
-	duk_compile_lstring_filename(g_duktape, 0x0, script->cstr, script->length);
-	duk_put_prop_index(g_duktape, -2, index);
-	duk_pop_2(g_duktape);
-	return index + 1;
+	else {
+		// compile before adding the script so that a syntax error doesn't leave a dead
+		// entry behind
+		duk_push_string(g_duktape, name);
+		duk_compile_lstring_filename(g_duktape, 0x0, script->cstr, script->length);
+		if ((body_id = add_script(script, hash, name)) == 0) {
+			duk_pop(g_duktape);
+			return 0;
+		}
+		store_function(body_id);
+		s_scripts[body_id - 1].is_compiled = true;
+	}
+	if ((script_id = add_handle(body_id)) == 0)
+		release_body(body_id);
+	return script_id;
+}
+
+int
+defer_script(const lstring_t* script, const char* name)
+{
+	// deferred scripts are kept as source and only compiled the first time they're
+	// run.  maps carry lots of trigger, zone and person scripts which never run
+	// during a visit, so there's no reason to make Duktape parse them all up front.
+
+	int          body_id;
+	unsigned int hash;
+	int          script_id;
+
+	if (script == NULL || script->length == 0)
+		return 0;  // an empty script is a no-op, same as script 0
+	hash = hash_source(script);
+	if ((body_id = find_script(script, hash)) > 0)
+		++s_scripts[body_id - 1].refcount;
+	else if ((body_id = add_script(script, hash, name)) == 0)
+		return 0;
+	if ((script_id = add_handle(body_id)) == 0)
+		release_body(body_id);
+	return script_id;
 }
 
 void
 free_script(int script_id)
 {
+	struct script_handle* handle;
+
 	if (script_id == 0)
 		return;
-	duk_push_global_stash(g_duktape);
-	if (!duk_get_prop_string(g_duktape, -1, "scripts")) {
-		duk_pop(g_duktape);
-		duk_push_array(g_duktape);
-	}
-	duk_push_null(g_duktape);
-	duk_put_prop_index(g_duktape, -2, script_id - 1);
-	duk_pop_2(g_duktape);
+	handle = &s_handles[script_id - 1];
+	release_body(handle->body_id);
+	handle->body_id = 0;
+	s_free_handles[s_num_free_handles++] = script_id;
 }
 
 void
 run_script(int script_id, bool allow_reentry)
 {
-	bool is_in_use;
+	// the stash array keeps compiled scripts reachable, but this is called for
+	// several scripts every frame, so the function is pushed straight from the heap
+	// pointer recorded when it was compiled and the reentry flag is kept in C.
+	
+	int   body_id;
+	void* heapptr;
+	bool  is_in_use;
 
 	if (script_id == 0)  // script 0 is guaranteed to be a no-op
 		return;
+	body_id = s_handles[script_id - 1].body_id;
+	if (!s_scripts[body_id - 1].is_compiled) {
+		// deferred script, compile it now.  if compilation fails the source is kept
+		// and the error is thrown to whoever tried to run the script.
+		compile_entry(body_id);
+	}
+	heapptr = s_scripts[body_id - 1].heapptr;
+	is_in_use = s_handles[script_id - 1].is_in_use;
+	if (is_in_use && !allow_reentry)
+		return;
+	s_handles[script_id - 1].is_in_use = true;
+	duk_push_heapptr(g_duktape, heapptr);
+	duk_call(g_duktape, 0);
+	duk_pop(g_duktape);
+
+	// the script may have been freed while it ran and its ID given to another one.
+	// in that case the body won't match and the flag isn't ours to touch.
+	if (s_handles[script_id - 1].body_id == body_id && s_scripts[body_id - 1].heapptr == heapptr)
+		s_handles[script_id - 1].is_in_use = is_in_use;
+}
+
+static int
+add_handle(int body_id)
+{
+	// gives a new owner its own script ID for a shared body.  the handle is what
+	// carries the reentry flag, so two owners of the same source don't block each
+	// other from running it.
+	
+	struct script_handle* handle;
+	int*                  new_ids;
+	struct script_handle* new_handles;
+	int                   new_max;
+	int                   script_id;
+
+	if (s_num_free_handles == 0 && s_num_handles >= s_max_handles) {
+		new_max = s_max_handles > 0 ? s_max_handles * 2 : 64;
+		if (!(new_handles = realloc(s_handles, new_max * sizeof(struct script_handle))))
+			return 0;
+		s_handles = new_handles;
+		if (!(new_ids = realloc(s_free_handles, new_max * sizeof(int))))
+			return 0;
+		s_free_handles = new_ids;
+		s_max_handles = new_max;
+	}
+	script_id = s_num_free_handles > 0 ? s_free_handles[--s_num_free_handles] : ++s_num_handles;
+	handle = &s_handles[script_id - 1];
+	handle->body_id = body_id;
+	handle->is_in_use = false;
+	return script_id;
+}
+
+static int
+add_script(const lstring_t* source, unsigned int hash, const char* name)
+{
+	int            body_id;
+	int            bucket;
+	int            new_max;
+	int*           new_ids;
+	struct script* new_scripts;
+	struct script* script;
+
+	if (s_hash_heads == NULL && !(s_hash_heads = calloc(SCRIPT_BUCKETS, sizeof(int))))
+		return 0;
+	if (s_num_free == 0 && s_num_scripts >= s_max_scripts) {
+		new_max = s_max_scripts > 0 ? s_max_scripts * 2 : 64;
+		if (!(new_scripts = realloc(s_scripts, new_max * sizeof(struct script))))
+			return 0;
+		s_scripts = new_scripts;
+		if (!(new_ids = realloc(s_free_ids, new_max * sizeof(int))))
+			return 0;
+		s_free_ids = new_ids;
+		s_max_scripts = new_max;
+	}
+	
+	// IDs of destroyed scripts are reused before new ones are handed out, which
+	// keeps both the registry and the stash array from filling up with holes
+	body_id = s_num_free > 0 ? s_free_ids[--s_num_free] : s_num_scripts + 1;
+	script = &s_scripts[body_id - 1];
+	memset(script, 0, sizeof(struct script));
+	if (!(script->name = strdup(name))) goto on_error;
+	if (!(script->source = clone_lstring(source))) goto on_error;
+	script->hash = hash;
+	script->refcount = 1;
+	bucket = hash & (SCRIPT_BUCKETS - 1);
+	script->hash_next = s_hash_heads[bucket];
+	s_hash_heads[bucket] = body_id;
+	if (body_id > s_num_scripts)
+		s_num_scripts = body_id;
+	return body_id;
+
+on_error:
+	free(script->name);
+	script->name = NULL;
+	if (body_id <= s_num_scripts)
+		s_free_ids[s_num_free++] = body_id;
+	return 0;
+}
+
+static void
+compile_entry(int body_id)
+{
+	struct script* script = &s_scripts[body_id - 1];
+
+	duk_push_string(g_duktape, script->name);
+	duk_compile_lstring_filename(g_duktape, 0x0, script->source->cstr, script->source->length);
+	store_function(body_id);
+	script->is_compiled = true;
+}
+
+static void
+destroy_script(int body_id)
+{
+	int*           p_link;
+	struct script* script;
+
+	script = &s_scripts[body_id - 1];
+	p_link = &s_hash_heads[script->hash & (SCRIPT_BUCKETS - 1)];
+	while (*p_link != body_id)
+		p_link = &s_scripts[*p_link - 1].hash_next;
+	*p_link = script->hash_next;
+	free(script->name);
+	free_lstring(script->source);
+	script->name = NULL;
+	script->source = NULL;
+	script->heapptr = NULL;
+	script->is_compiled = false;
+	push_script_array();
+	duk_push_null(g_duktape);
+	duk_put_prop_index(g_duktape, -2, body_id - 1);
+	duk_pop_2(g_duktape);
+	s_free_ids[s_num_free++] = body_id;
+}
+
+static int
+find_script(const lstring_t* source, unsigned int hash)
+{
+	struct script* script;
+	int            body_id;
+
+	if (s_hash_heads == NULL)
+		return 0;
+	body_id = s_hash_heads[hash & (SCRIPT_BUCKETS - 1)];
+	while (body_id > 0) {
+		script = &s_scripts[body_id - 1];
+		if (script->hash == hash && script->source->length == source->length
+		    && memcmp(script->source->cstr, source->cstr, source->length) == 0)
+		{
+			return body_id;
+		}
+		body_id = script->hash_next;
+	}
+	return 0;
+}
+
+static unsigned int
+hash_source(const lstring_t* source)
+{
+	unsigned int hash = 2166136261U;
+
+	size_t i;
+
+	for (i = 0; i < source->length; ++i)
+		hash = (hash ^ (unsigned char)source->cstr[i]) * 16777619U;
+	return hash;
+}
+
+static void
+push_script_array(void)
+{
+	// pushes the global stash followed by the array of compiled scripts
 	duk_push_global_stash(g_duktape);
 	if (!duk_get_prop_string(g_duktape, -1, "scripts")) {
 		duk_pop(g_duktape);
-		duk_push_array(g_duktape);
+		duk_push_array(g_duktape); duk_put_prop_string(g_duktape, -2, "scripts");
+		duk_get_prop_string(g_duktape, -1, "scripts");
 	}
-	duk_get_prop_index(g_duktape, -1, script_id - 1);
-	if (duk_is_callable(g_duktape, -1)) {
-		duk_get_prop_string(g_duktape, -1, "isInUse");
-		is_in_use = duk_to_boolean(g_duktape, -1);
-		duk_pop(g_duktape);
-		if (!is_in_use || allow_reentry) {
-			duk_push_true(g_duktape);
-			duk_put_prop_string(g_duktape, -2, "isInUse");
-			duk_call(g_duktape, 0);
-			duk_get_prop_index(g_duktape, -2, script_id - 1);
-			if (!duk_is_null(g_duktape, -1)) {
-				duk_push_boolean(g_duktape, is_in_use);
-				duk_put_prop_string(g_duktape, -2, "isInUse");
-			}
-			duk_pop(g_duktape);
+}
+
+static void
+release_body(int body_id)
+{
+	// a body nobody holds anymore isn't destroyed right away; it's put in a queue
+	// and kept until SCRIPT_IDLE_MAX more bodies have gone idle.  this way the same
+	// scripts coming back (i.e. on the next map or the next queued command) don't
+	// have to be compiled again.
+
+	struct idle_script oldest;
+	struct script*     script;
+
+	script = &s_scripts[body_id - 1];
+	if (--script->refcount > 0)
+		return;
+	if (s_idle == NULL && !(s_idle = malloc(SCRIPT_IDLE_MAX * sizeof(struct idle_script)))) {
+		destroy_script(body_id);
+		return;
+	}
+	if (s_num_idle == SCRIPT_IDLE_MAX) {
+		// an entry is stale if its body was picked up again after going idle
+		oldest = s_idle[s_idle_head];
+		s_idle_head = (s_idle_head + 1) % SCRIPT_IDLE_MAX;
+		--s_num_idle;
+		if (s_scripts[oldest.body_id - 1].refcount == 0
+		    && s_scripts[oldest.body_id - 1].idle_stamp == oldest.stamp)
+		{
+			destroy_script(oldest.body_id);
 		}
 	}
+	script->idle_stamp = ++s_idle_clock;
+	s_idle[(s_idle_head + s_num_idle) % SCRIPT_IDLE_MAX].body_id = body_id;
+	s_idle[(s_idle_head + s_num_idle) % SCRIPT_IDLE_MAX].stamp = script->idle_stamp;
+	++s_num_idle;
+}
+
+static void
+store_function(int body_id)
+{
+	// pops a compiled function off the value stack and makes it the body of a script.
+	// the stash reference is what keeps the function alive for its heap pointer.
+	s_scripts[body_id - 1].heapptr = duk_get_heapptr(g_duktape, -1);
+	push_script_array();
+	duk_dup(g_duktape, -3);
+	duk_put_prop_index(g_duktape, -2, body_id - 1);
 	duk_pop_3(g_duktape);
 }
@@ -48,6 +48,12 @@ struct rss_frame_v3
 };
 #pragma pack(pop)
 
+struct cached_spriteset
+{
+	char*        path;
+	spriteset_t* spriteset;
+};
+
 static duk_ret_t js_LoadSpriteset       (duk_context* ctx);
 static duk_ret_t js_Spriteset_finalize  (duk_context* ctx);
 static duk_ret_t js_Spriteset_toString  (duk_context* ctx);
@@ -55,7 +61,14 @@ static duk_ret_t js_Spriteset_clone     (duk_context* ctx);
 static duk_ret_t js_Spriteset_get_image (duk_context* ctx);
 static duk_ret_t js_Spriteset_set_image (duk_context* ctx);
 
-static const spriteset_pose_t* find_sprite_pose (const spriteset_t* spriteset, const char* pose_name);
+static image_t*                create_frame_atlas (int num_frames, rect_t* frames);
+static const spriteset_pose_t* find_sprite_pose   (const spriteset_t* spriteset, const char* pose_name);
+static image_t*                read_frame_image   (FILE* file, image_t* atlas, rect_t frame);
+static void                    uncache_spriteset  (spriteset_t* spriteset);
+
+static int                     s_max_cached = 0;
+static int                     s_num_cached = 0;
+static struct cached_spriteset *s_cache     = NULL;
 
 spriteset_t*
 clone_spriteset(const spriteset_t* spriteset)
@@ -67,6 +80,8 @@ clone_spriteset(const spriteset_t* spriteset)
 	if ((clone = calloc(1, sizeof(spriteset_t))) == NULL)
 		goto on_error;
 	clone->base = spriteset->base;
+	if (spriteset->filename != NULL && !(clone->filename = clone_lstring(spriteset->filename)))
+		goto on_error;
 	clone->num_images = spriteset->num_images;
 	clone->num_poses = spriteset->num_poses;
 	clone->images = calloc(clone->num_images, sizeof(image_t*));
@@ -93,6 +108,7 @@ on_error:
 				free_lstring(clone->poses[i].name);
 				free(clone->poses[i].frames);
 			}
+		free_lstring(clone->filename);
 		free(clone);
 	}
 	return NULL;
@@ -110,21 +126,35 @@ load_spriteset(const char* path)
 		"south", "southwest", "west", "northwest"
 	};
 	
-	char*               base_path;
-	struct rss_dir_v2   dir_v2;
-	struct rss_dir_v3   dir_v3;
-	char                extra_v2_dir_name[32];
-	ALLEGRO_PATH*       filename_path;
-	struct rss_frame_v2 frame_v2;
-	struct rss_frame_v3 frame_v3;
-	FILE*               file = NULL;
-	int                 image_index;
-	struct rss_header   rss;
-	long                skip_size;
-	spriteset_t*        spriteset = NULL;
-	long                v2_data_offset;
-	int                 i, j;
-
+	image_t*                atlas = NULL;
+	char*                   base_path;
+	struct cached_spriteset *cache_entry;
+	struct rss_dir_v2       dir_v2;
+	struct rss_dir_v3       dir_v3;
+	char                    extra_v2_dir_name[32];
+	ALLEGRO_PATH*           filename_path;
+	struct rss_frame_v2     frame_v2;
+	struct rss_frame_v3     frame_v3;
+	FILE*                   file = NULL;
+	rect_t                  *frames = NULL;
+	const char*             full_path;
+	int                     image_index;
+	struct cached_spriteset *new_cache;
+	rect_t                  *new_frames;
+	struct rss_header       rss;
+	long                    skip_size;
+	spriteset_t*            spriteset = NULL;
+	long                    v2_data_offset;
+	int                     i, j;
+
+	// spritesets are shared between everyone who loads the same file.  the cache
+	// doesn't hold a reference; free_spriteset() evicts a set when the last one goes.
+	full_path = path;
+	for (i = 0; i < s_num_cached; ++i) {
+		if (strcmp(path, s_cache[i].path) == 0)
+			return ref_spriteset(s_cache[i].spriteset);
+	}
+	
 	if ((spriteset = calloc(1, sizeof(spriteset_t))) == NULL) goto on_error;
 	if (!(file = fopen(path, "rb"))) goto on_error;
 	if (fread(&rss, sizeof(struct rss_header), 1, file) != 1)
@@ -143,8 +173,12 @@ load_spriteset(const char* path)
 			spriteset->poses[i].name = lstring_from_cstr(def_dir_names[i]);
 		if ((spriteset->images = calloc(spriteset->num_images, sizeof(image_t*))) == NULL)
 			goto on_error;
+		if (!(frames = calloc(spriteset->num_images, sizeof(rect_t)))) goto on_error;
+		for (i = 0; i < spriteset->num_images; ++i)
+			frames[i] = new_rect(0, 0, rss.frame_width, rss.frame_height);
+		atlas = create_frame_atlas(spriteset->num_images, frames);
 		for (i = 0; i < spriteset->num_images; ++i) {
-			if ((spriteset->images[i] = read_image(file, rss.frame_width, rss.frame_height)) == NULL)
+			if ((spriteset->images[i] = read_frame_image(file, atlas, frames[i])) == NULL)
 				goto on_error;
 		}
 		for (i = 0; i < spriteset->num_poses; ++i) {
@@ -173,17 +207,25 @@ load_spriteset(const char* path)
 			spriteset->poses[i].num_frames = dir_v2.num_frames;
 			if (!(spriteset->poses[i].frames = calloc(dir_v2.num_frames, sizeof(spriteset_frame_t))))
 				goto on_error;
+			if (dir_v2.num_frames > 0) {
+				if (!(new_frames = realloc(frames, spriteset->num_images * sizeof(rect_t))))
+					goto on_error;
+				frames = new_frames;
+			}
 			for (j = 0; j < dir_v2.num_frames; ++j) {  // skip over frame and image data
 				if (fread(&frame_v2, sizeof(struct rss_frame_v2), 1, file) != 1)
 					goto on_error;
-				skip_size = (rss.frame_width != 0 ? rss.frame_width : frame_v2.width)
-					* (rss.frame_height != 0 ? rss.frame_height : frame_v2.height)
-					* 4;
+				image_index = spriteset->num_images - dir_v2.num_frames + j;
+				frames[image_index] = new_rect(0, 0,
+					rss.frame_width != 0 ? rss.frame_width : frame_v2.width,
+					rss.frame_height != 0 ? rss.frame_height : frame_v2.height);
+				skip_size = frames[image_index].x2 * frames[image_index].y2 * 4;
 				fseek(file, skip_size, SEEK_CUR);
 			}
 		}
 		if (!(spriteset->images = calloc(spriteset->num_images, sizeof(image_t*))))
 			goto on_error;
+		atlas = create_frame_atlas(spriteset->num_images, frames);
 
 		// pass 2 - read images and frame data
 		fseek(file, v2_data_offset, SEEK_SET);
@@ -194,9 +236,8 @@ load_spriteset(const char* path)
 			for (j = 0; j < dir_v2.num_frames; ++j) {
 				if (fread(&frame_v2, sizeof(struct rss_frame_v2), 1, file) != 1)
 					goto on_error;
-				spriteset->images[image_index] = read_image(file,
-					rss.frame_width != 0 ? rss.frame_width : frame_v2.width,
-					rss.frame_height != 0 ? rss.frame_height : frame_v2.height);
+				if (!(spriteset->images[image_index] = read_frame_image(file, atlas, frames[image_index])))
+					goto on_error;
 				spriteset->poses[i].frames[j].image_idx = image_index;
 				spriteset->poses[i].frames[j].delay = frame_v2.delay;
 				++image_index;
@@ -210,8 +251,12 @@ load_spriteset(const char* path)
 			goto on_error;
 		if ((spriteset->poses = calloc(spriteset->num_poses, sizeof(spriteset_pose_t))) == NULL)
 			goto on_error;
+		if (!(frames = calloc(spriteset->num_images, sizeof(rect_t)))) goto on_error;
+		for (i = 0; i < spriteset->num_images; ++i)
+			frames[i] = new_rect(0, 0, rss.frame_width, rss.frame_height);
+		atlas = create_frame_atlas(spriteset->num_images, frames);
 		for (i = 0; i < rss.num_images; ++i) {
-			if ((spriteset->images[i] = read_image(file, rss.frame_width, rss.frame_height)) == NULL)
+			if ((spriteset->images[i] = read_frame_image(file, atlas, frames[i])) == NULL)
 				goto on_error;
 		}
 		for (i = 0; i < rss.num_directions; ++i) {
@@ -233,6 +278,12 @@ load_spriteset(const char* path)
 		goto on_error;
 	}
 	fclose(file);
+	if (atlas != NULL) {
+		// the frames hold references to the atlas, so we can let go of ours
+		unlock_image(atlas);
+		free_image(atlas);
+	}
+	free(frames);
 	
 	// get spriteset path relative to game directory
 	base_path = get_asset_path("~/", NULL, false);
@@ -242,11 +293,31 @@ load_spriteset(const char* path)
 	al_destroy_path(filename_path);
 	free(base_path);
 	
+	if (s_num_cached >= s_max_cached) {
+		s_max_cached = (s_num_cached + 1) * 2;
+		if ((new_cache = realloc(s_cache, s_max_cached * sizeof(struct cached_spriteset))) != NULL)
+			s_cache = new_cache;
+		else
+			s_max_cached = s_num_cached;
+	}
+	if (s_num_cached < s_max_cached) {
+		cache_entry = &s_cache[s_num_cached];
+		if ((cache_entry->path = strdup(full_path)) != NULL) {
+			cache_entry->spriteset = spriteset;
+			++s_num_cached;
+		}
+	}
 	return ref_spriteset(spriteset);
 
 on_error:
 	if (file != NULL) fclose(file);
+	free(frames);
 	if (spriteset != NULL) {
+		if (spriteset->images != NULL) {
+			for (i = 0; i < spriteset->num_images; ++i)
+				free_image(spriteset->images[i]);
+			free(spriteset->images);
+		}
 		if (spriteset->poses != NULL) {
 			for (i = 0; i < spriteset->num_poses; ++i) {
 				free_lstring(spriteset->poses[i].name);
@@ -256,6 +327,7 @@ on_error:
 		}
 		free(spriteset);
 	}
+	free_image(atlas);
 	return NULL;
 }
 
@@ -273,6 +345,7 @@ free_spriteset(spriteset_t* spriteset)
 	
 	if (spriteset == NULL || --spriteset->refcount > 0)
 		return;
+	uncache_spriteset(spriteset);
 	for (i = 0; i < spriteset->num_images; ++i) {
 		free_image(spriteset->images[i]);
 	}
@@ -293,16 +366,24 @@ get_sprite_base(const spriteset_t* spriteset)
 }
 
 int
-get_sprite_frame_delay(const spriteset_t* spriteset, const char* pose_name, int frame_index)
+get_sprite_frame_delay(const spriteset_t* spriteset, int pose_index, int frame_index)
 {
 	const spriteset_pose_t* pose;
 	
-	if ((pose = find_sprite_pose(spriteset, pose_name)) == NULL)
-		return 0;
+	pose = &spriteset->poses[pose_index];
 	frame_index %= pose->num_frames;
 	return pose->frames[frame_index].delay;
 }
 
+int
+get_sprite_pose_index(const spriteset_t* spriteset, const char* pose_name)
+{
+	// resolving a pose involves string compares, so callers drawing the same pose
+	// every frame should look up its index once and hold on to it
+	
+	return find_sprite_pose(spriteset, pose_name) - spriteset->poses;
+}
+
 void
 get_sprite_size(const spriteset_t* spriteset, int* out_width, int* out_height)
 {
@@ -348,15 +429,14 @@ set_spriteset_image(const spriteset_t* spriteset, int image_index, image_t* imag
 }
 
 void
-draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, const char* pose_name, float x, float y, int frame_index)
+draw_sprite(const spriteset_t* spriteset, color_t mask, bool is_flipped, double theta, double scale_x, double scale_y, int pose_index, float x, float y, int frame_index)
 {
 	image_t*                 image;
 	int                      image_index;
 	int                      image_w, image_h;
 	const spriteset_pose_t*  pose;
 	
-	if ((pose = find_sprite_pose(spriteset, pose_name)) == NULL)
-		return;
+	pose = &spriteset->poses[pose_index];
 	frame_index = frame_index % pose->num_frames;
 	image_index = pose->frames[frame_index].image_idx;
 	x -= (spriteset->base.x1 + spriteset->base.x2) / 2;
@@ -468,6 +548,48 @@ on_error:
 	duk_error_ni(ctx, -1, DUK_ERR_TYPE_ERROR, "Object is not a Sphere spriteset");
 }
 
+static image_t*
+create_frame_atlas(int num_frames, rect_t* frames)
+{
+	// shelf-packs a spriteset's frames into a single image, so that persons using the
+	// spriteset can be drawn without switching textures.  on entry, frames[] holds the
+	// size of each frame in x2/y2; on return, it holds each frame's place in the atlas.
+	// returns the atlas locked for writing, or NULL to fall back on separate bitmaps.
+	
+	image_t* atlas;
+	int      atlas_w = 0, atlas_h;
+	int      frame_w, frame_h;
+	int      shelf_h = 0;
+	double   total_area = 0.0;
+	int      x = 0, y = 0;
+
+	int i;
+
+	for (i = 0; i < num_frames; ++i) {
+		total_area += (double)frames[i].x2 * frames[i].y2;
+		if (frames[i].x2 > atlas_w) atlas_w = frames[i].x2;
+	}
+	atlas_w = fmax(atlas_w, ceil(sqrt(total_area)));
+	for (i = 0; i < num_frames; ++i) {
+		frame_w = frames[i].x2;
+		frame_h = frames[i].y2;
+		if (x + frame_w > atlas_w) {
+			x = 0; y += shelf_h;
+			shelf_h = 0;
+		}
+		frames[i] = new_rect(x, y, x + frame_w, y + frame_h);
+		x += frame_w;
+		if (frame_h > shelf_h) shelf_h = frame_h;
+	}
+	atlas_h = y + shelf_h;
+	if (atlas_w <= 0 || atlas_h <= 0)
+		return NULL;
+	if (!(atlas = create_image(atlas_w, atlas_h)))
+		return NULL;
+	lock_image(atlas);
+	return atlas;
+}
+
 static const spriteset_pose_t*
 find_sprite_pose(const spriteset_t* spriteset, const char* pose_name)
 {
@@ -494,6 +616,31 @@ find_sprite_pose(const spriteset_t* spriteset, const char* pose_name)
 	return pose != NULL ? pose : &spriteset->poses[0];
 }
 
+static image_t*
+read_frame_image(FILE* file, image_t* atlas, rect_t frame)
+{
+	int width = frame.x2 - frame.x1;
+	int height = frame.y2 - frame.y1;
+	
+	return atlas != NULL
+		? read_subimage(file, atlas, frame.x1, frame.y1, width, height)
+		: read_image(file, width, height);
+}
+
+static void
+uncache_spriteset(spriteset_t* spriteset)
+{
+	int i;
+
+	for (i = 0; i < s_num_cached; ++i) {
+		if (s_cache[i].spriteset == spriteset) {
+			free(s_cache[i].path);
+			s_cache[i] = s_cache[--s_num_cached];
+			return;
+		}
+	}
+}
+
 static duk_ret_t
 js_LoadSpriteset(duk_context* ctx)
 {
@@ -564,10 +711,21 @@ js_Spriteset_set_image(duk_context* ctx)
 	image_t* image = duk_require_sphere_image(ctx, 0);
 	duk_uarridx_t index = duk_to_int(ctx, 1);
 
+	spriteset_t* new_spriteset;
 	spriteset_t* spriteset;
 
 	duk_push_this(ctx);
 	duk_get_prop_string(ctx, -1, "\xFF" "ptr"); spriteset = duk_get_pointer(ctx, -1); duk_pop(ctx);
+	if (spriteset->refcount > 1) {
+		// spriteset is shared, copy it before writing so nobody else sees the change
+		if ((new_spriteset = clone_spriteset(spriteset)) == NULL)
+			duk_error_ni(ctx, -1, DUK_ERR_ERROR, "Spriteset:set_image(): Failed to copy shared spriteset");
+		duk_push_pointer(ctx, new_spriteset); duk_put_prop_string(ctx, -2, "\xFF" "ptr");
+		free_spriteset(spriteset);
+		spriteset = new_spriteset;
+	}
+	else
+		uncache_spriteset(spriteset);
 	duk_pop(ctx);
 	set_spriteset_image(spriteset, index, image);
 	return 0;
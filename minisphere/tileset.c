@@ -4,23 +4,41 @@
 
 #include "tileset.h"
 
+static void schedule_tile   (tileset_t* tileset, int tile_index, int delay);
+static void unschedule_tile (tileset_t* tileset, int tile_index);
+static void sift_tile_down  (tileset_t* tileset, int heap_pos);
+static void sift_tile_up    (tileset_t* tileset, int heap_pos);
+static void draw_mask_line  (uint64_t* mask, int pitch, int width, int height, rect_t line);
+static bool test_mask_row   (const uint64_t* row, int width, int x1, int x2);
+
 struct tileset
 {
-	int         width, height;
-	int         num_tiles;
-	struct tile *tiles;
+	image_t*     atlas;
+	unsigned int clock;
+	int          width, height;
+	int          mask_pitch;
+	int          num_changed;
+	int          num_scheduled;
+	int          num_tiles;
+	int          *changed;
+	int          *schedule;
+	struct tile  *tiles;
 };
 
 struct tile
 {
-	lstring_t* name;
-	int        animate_index;
-	int        frames_left;
-	image_t*   image;
-	int        delay;
-	int        next_index;
-	int        num_obs_lines;
-	obsmap_t*  obsmap;
+	lstring_t*   name;
+	int          animate_index;
+	unsigned int next_change;
+	int          schedule_pos;
+	image_t*     image;
+	bool         is_in_atlas;
+	int          atlas_x, atlas_y;
+	int          delay;
+	int          next_index;
+	int          num_obs_lines;
+	obsmap_t*    obsmap;
+	uint64_t*    obs_mask;
 };
 
 #pragma pack(push, 1)
@@ -67,9 +85,10 @@ load_tileset(const char* path)
 tileset_t*
 read_tileset(FILE* file)
 {
-	image_t*               atlas;
+	image_t*               atlas = NULL;
 	int                    atlas_w, atlas_h;
 	long                   file_pos;
+	int                    mask_pitch;
 	int                    n_tiles_per_row;
 	struct rts_header      rts;
 	rect_t                 segment;
@@ -88,22 +107,33 @@ read_tileset(FILE* file)
 		goto on_error;
 	if (rts.tile_bpp != 32) goto on_error;
 	if (!(tiles = calloc(rts.num_tiles, sizeof(struct tile)))) goto on_error;
+	if (!(tileset->changed = malloc(rts.num_tiles * sizeof(int)))) goto on_error;
+	if (!(tileset->schedule = malloc(rts.num_tiles * sizeof(int)))) goto on_error;
 	
 	// prepare the tile atlas
 	n_tiles_per_row = ceil(sqrt(rts.num_tiles));
 	atlas_w = rts.tile_width * n_tiles_per_row;
 	atlas_h = rts.tile_height * n_tiles_per_row;
 	if (!(atlas = create_image(atlas_w, atlas_h))) goto on_error;
+	if (!lock_image(atlas)) goto on_error;
 
 	// read in tile bitmaps
 	for (i = 0; i < rts.num_tiles; ++i) {
+		tiles[i].atlas_x = i % n_tiles_per_row * rts.tile_width;
+		tiles[i].atlas_y = i / n_tiles_per_row * rts.tile_height;
 		tiles[i].image = read_subimage(file, atlas,
-			i % n_tiles_per_row * rts.tile_width, i / n_tiles_per_row * rts.tile_height,
-			rts.tile_width, rts.tile_height);
+			tiles[i].atlas_x, tiles[i].atlas_y, rts.tile_width, rts.tile_height);
 		if (tiles[i].image == NULL) goto on_error;
+		tiles[i].is_in_atlas = true;
 	}
+	unlock_image(atlas);
 
-	// read in tile headers and obstruction maps
+	// read in tile headers and obstruction maps.  each tile's segments are also
+	// rasterized into a bitmask, one row of 64-bit words per pixel row, for games
+	// using bitmask collision.  segments may lie along the right or bottom edge of the
+	// tile (x == width or y == height), so the mask is one pixel wider and taller than
+	// the tile itself.
+	mask_pitch = (rts.tile_width + 1 + 63) / 64;
 	for (i = 0; i < rts.num_tiles; ++i) {
 		if (fread(&tilehdr, sizeof(struct rts_tile_header), 1, file) != 1)
 			goto on_error;
@@ -111,7 +141,7 @@ read_tileset(FILE* file)
 		tiles[i].next_index = tilehdr.animated ? tilehdr.next_tile : i;
 		tiles[i].delay = tilehdr.animated ? tilehdr.delay : 0;
 		tiles[i].animate_index = i;
-		tiles[i].frames_left = tiles[i].delay;
+		tiles[i].schedule_pos = -1;
 		if (rts.has_obstructions) {
 			switch (tilehdr.obsmap_type) {
 			case 1:  // pixel-perfect obstruction (no longer supported)
@@ -120,10 +150,15 @@ read_tileset(FILE* file)
 			case 2:  // line segment-based obstruction
 				tiles[i].num_obs_lines = tilehdr.num_segments;
 				if ((tiles[i].obsmap = new_obsmap()) == NULL) goto on_error;
+				if (tilehdr.num_segments > 0) {
+					if (!(tiles[i].obs_mask = calloc((rts.tile_height + 1) * mask_pitch, sizeof(uint64_t))))
+						goto on_error;
+				}
 				for (j = 0; j < tilehdr.num_segments; ++j) {
 					if (!fread_rect_16(file, &segment))
 						goto on_error;
 					add_obsmap_line(tiles[i].obsmap, segment);
+					draw_mask_line(tiles[i].obs_mask, mask_pitch, rts.tile_width + 1, rts.tile_height + 1, segment);
 				}
 				break;
 			default:
@@ -133,11 +168,14 @@ read_tileset(FILE* file)
 	}
 
 	// wrap things up
-	free_image(atlas);
+	tileset->atlas = atlas;
 	tileset->width = rts.tile_width;
 	tileset->height = rts.tile_height;
+	tileset->mask_pitch = mask_pitch;
 	tileset->num_tiles = rts.num_tiles;
 	tileset->tiles = tiles;
+	for (i = 0; i < rts.num_tiles; ++i)
+		schedule_tile(tileset, i, tiles[i].delay);
 	return tileset;
 
 on_error:  // oh no!
@@ -146,15 +184,72 @@ on_error:  // oh no!
 		for (i = 0; i < rts.num_tiles; ++i) {
 			free_lstring(tiles[i].name);
 			free_obsmap(tiles[i].obsmap);
+			free(tiles[i].obs_mask);
 			free_image(tiles[i].image);
 		}
-		free(tileset->tiles);
+		free(tiles);
 	}
 	if (atlas != NULL) free_image(atlas);
+	if (tileset != NULL) {
+		free(tileset->changed);
+		free(tileset->schedule);
+	}
 	free(tileset);
 	return NULL;
 }
 
+tileset_t*
+clone_tileset(const tileset_t* tileset)
+{
+	// clones share images with the original, but have their own animation state.
+	// set_tile_image() only swaps references, so changes made to the clone don't
+	// affect the original.
+	
+	tileset_t*   clone = NULL;
+	size_t       mask_size;
+	struct tile* tile;
+
+	int i;
+
+	if ((clone = calloc(1, sizeof(tileset_t))) == NULL) goto on_error;
+	if (!(clone->tiles = calloc(tileset->num_tiles, sizeof(struct tile)))) goto on_error;
+	if (!(clone->changed = malloc(tileset->num_tiles * sizeof(int)))) goto on_error;
+	if (!(clone->schedule = malloc(tileset->num_tiles * sizeof(int)))) goto on_error;
+	clone->width = tileset->width;
+	clone->height = tileset->height;
+	clone->mask_pitch = tileset->mask_pitch;
+	mask_size = (tileset->height + 1) * tileset->mask_pitch * sizeof(uint64_t);
+	for (i = 0; i < tileset->num_tiles; ++i) {
+		tile = &clone->tiles[i];
+		*tile = tileset->tiles[i];
+		tile->name = NULL; tile->obsmap = NULL; tile->obs_mask = NULL;
+		tile->image = ref_image(tileset->tiles[i].image);
+		++clone->num_tiles;
+		tile->animate_index = i;
+		tile->schedule_pos = -1;
+		if (tileset->tiles[i].name != NULL && !(tile->name = clone_lstring(tileset->tiles[i].name)))
+			goto on_error;
+		if (tileset->tiles[i].obsmap != NULL && !(tile->obsmap = clone_obsmap(tileset->tiles[i].obsmap)))
+			goto on_error;
+		if (tileset->tiles[i].obs_mask != NULL) {
+			if (!(tile->obs_mask = malloc(mask_size)))
+				goto on_error;
+			memcpy(tile->obs_mask, tileset->tiles[i].obs_mask, mask_size);
+		}
+	}
+	clone->atlas = ref_image(tileset->atlas);
+	for (i = 0; i < clone->num_tiles; ++i)
+		schedule_tile(clone, i, clone->tiles[i].delay);
+	return clone;
+
+on_error:
+	if (clone != NULL) {
+		if (clone->tiles != NULL) free_tileset(clone);
+		else free(clone);
+	}
+	return NULL;
+}
+
 void
 free_tileset(tileset_t* tileset)
 {
@@ -164,11 +259,36 @@ free_tileset(tileset_t* tileset)
 		free_lstring(tileset->tiles[i].name);
 		free_image(tileset->tiles[i].image);
 		free_obsmap(tileset->tiles[i].obsmap);
+		free(tileset->tiles[i].obs_mask);
 	}
 	free(tileset->tiles);
+	free(tileset->changed);
+	free(tileset->schedule);
+	free_image(tileset->atlas);
 	free(tileset);
 }
 
+image_t*
+get_tile_atlas(const tileset_t* tileset)
+{
+	return tileset->atlas;
+}
+
+int
+get_animated_tile(const tileset_t* tileset, int tile_index)
+{
+	return tileset->tiles[tile_index].animate_index;
+}
+
+const int*
+get_changed_tiles(const tileset_t* tileset, int* out_count)
+{
+	// returns the indices of all tiles whose animation frame changed during the last
+	// call to animate_tileset()
+	*out_count = tileset->num_changed;
+	return tileset->changed;
+}
+
 int
 get_next_tile(const tileset_t* tileset, int tile_index)
 {
@@ -209,6 +329,17 @@ get_tile_obsmap(const tileset_t* tileset, int tile_index)
 	return tileset->tiles[tile_index].obsmap;
 }
 
+bool
+get_tile_uv(const tileset_t* tileset, int tile_index, int* out_u, int* out_v)
+{
+	// returns false if the tile's image has been replaced and is no longer in the atlas
+	if (!tileset->tiles[tile_index].is_in_atlas)
+		return false;
+	*out_u = tileset->tiles[tile_index].atlas_x;
+	*out_v = tileset->tiles[tile_index].atlas_y;
+	return true;
+}
+
 void
 get_tile_size(const tileset_t* tileset, int* out_w, int* out_h)
 {
@@ -216,6 +347,13 @@ get_tile_size(const tileset_t* tileset, int* out_w, int* out_h)
 	*out_h = tileset->height;
 }
 
+bool
+is_tile_animated(const tileset_t* tileset, int tile_index)
+{
+	// once a tile's animation reaches a frame with no delay, it never changes again
+	return tileset->tiles[tile_index].schedule_pos >= 0;
+}
+
 void
 set_next_tile(tileset_t* tileset, int tile_index, int next_index)
 {
@@ -225,7 +363,15 @@ set_next_tile(tileset_t* tileset, int tile_index, int next_index)
 void
 set_tile_delay(tileset_t* tileset, int tile_index, int delay)
 {
-	tileset->tiles[tile_index].delay = delay;
+	struct tile* tile;
+
+	// if the tile is currently showing its own image, restart its countdown with the
+	// new delay.  tiles showing it as part of another animation aren't affected until
+	// they cycle back around to it.
+	tile = &tileset->tiles[tile_index];
+	tile->delay = delay;
+	if (tile->animate_index == tile_index)
+		schedule_tile(tileset, tile_index, delay);
 }
 
 void
@@ -235,22 +381,112 @@ set_tile_image(tileset_t* tileset, int tile_index, image_t* image)
 	
 	old_image = tileset->tiles[tile_index].image;
 	tileset->tiles[tile_index].image = ref_image(image);
+	tileset->tiles[tile_index].is_in_atlas = false;
 	free_image(old_image);
 }
 
-void
-animate_tileset(tileset_t* tileset)
+bool
+test_tile_mask(const tileset_t* tileset, int tile_index, rect_t rect)
 {
-	struct tile* tile;
+	// the bitmask counterpart to test_obsmap_rect(): checks whether the outline of
+	// a rectangle, relative to the tile, touches any of the tile's obstruction pixels.
+	// the top and bottom edges are tested a word at a time; the sides are one bit
+	// test per row.
 	
+	const uint64_t* mask;
+	int             mask_w, mask_h;
+	int             pitch;
+	int             x1, y1, x2, y2;
+
+	int y;
+
+	if (!(mask = tileset->tiles[tile_index].obs_mask))
+		return false;
+	pitch = tileset->mask_pitch;
+	mask_w = tileset->width + 1;
+	mask_h = tileset->height + 1;
+	x1 = fmin(rect.x1, rect.x2); x2 = fmax(rect.x1, rect.x2);
+	y1 = fmin(rect.y1, rect.y2); y2 = fmax(rect.y1, rect.y2);
+	if (x2 < 0 || y2 < 0 || x1 >= mask_w || y1 >= mask_h)
+		return false;
+	if (y1 >= 0 && test_mask_row(&mask[y1 * pitch], mask_w, x1, x2))
+		return true;
+	if (y2 < mask_h && test_mask_row(&mask[y2 * pitch], mask_w, x1, x2))
+		return true;
+	for (y = y1 > 0 ? y1 : 0; y <= y2 && y < mask_h; ++y) {
+		if (x1 >= 0 && (mask[y * pitch + x1 / 64] >> (x1 % 64) & 1))
+			return true;
+		if (x2 < mask_w && (mask[y * pitch + x2 / 64] >> (x2 % 64) & 1))
+			return true;
+	}
+	return false;
+}
+
+bool
+upload_tileset(tileset_t* tileset)
+{
+	// a tileset loaded on a background thread ends up in memory bitmaps.  this moves
+	// the atlas to the GPU and re-points the tiles at it.  it must be called from the
+	// thread owning the display, and does nothing if the atlas is already there.
+	
+	image_t*  atlas;
+	image_t** images;
+
 	int i;
 
+	if (!(al_get_bitmap_flags(get_image_bitmap(tileset->atlas)) & ALLEGRO_MEMORY_BITMAP))
+		return true;
+	if (!(atlas = clone_image(tileset->atlas)))
+		return false;
+	if (!(images = calloc(tileset->num_tiles, sizeof(image_t*)))) {
+		free_image(atlas);
+		return false;
+	}
 	for (i = 0; i < tileset->num_tiles; ++i) {
-		tile = &tileset->tiles[i];
-		if (tile->frames_left > 0 && --tile->frames_left == 0) {
-			tile->animate_index = get_next_tile(tileset, tile->animate_index);
-			tile->frames_left = get_tile_delay(tileset, tile->animate_index);
-		}
+		if (!tileset->tiles[i].is_in_atlas)
+			continue;
+		images[i] = create_subimage(atlas, tileset->tiles[i].atlas_x, tileset->tiles[i].atlas_y,
+			tileset->width, tileset->height);
+		if (images[i] == NULL) goto on_error;
+	}
+	for (i = 0; i < tileset->num_tiles; ++i) {
+		if (images[i] == NULL)
+			continue;
+		free_image(tileset->tiles[i].image);
+		tileset->tiles[i].image = images[i];
+	}
+	free(images);
+	free_image(tileset->atlas);
+	tileset->atlas = atlas;
+	return true;
+
+on_error:
+	for (i = 0; i < tileset->num_tiles; ++i)
+		free_image(images[i]);
+	free(images);
+	free_image(atlas);
+	return false;
+}
+
+void
+animate_tileset(tileset_t* tileset)
+{
+	// animated tiles are kept in a min-heap ordered by the frame of their next change,
+	// so only tiles which are actually due get touched.
+	
+	int          tile_index;
+	struct tile* tile;
+	
+	++tileset->clock;
+	tileset->num_changed = 0;
+	while (tileset->num_scheduled > 0) {
+		tile_index = tileset->schedule[0];
+		tile = &tileset->tiles[tile_index];
+		if ((int)(tile->next_change - tileset->clock) > 0)
+			break;
+		tile->animate_index = get_next_tile(tileset, tile->animate_index);
+		tileset->changed[tileset->num_changed++] = tile_index;
+		schedule_tile(tileset, tile_index, get_tile_delay(tileset, tile->animate_index));
 	}
 }
 
@@ -261,3 +497,129 @@ draw_tile(const tileset_t* tileset, color_t mask, float x, float y, int tile_ind
 	al_draw_tinted_bitmap(get_image_bitmap(tileset->tiles[tile_index].image),
 		al_map_rgba(mask.r, mask.g, mask.b, mask.alpha), x, y, 0x0);
 }
+
+static void
+schedule_tile(tileset_t* tileset, int tile_index, int delay)
+{
+	struct tile* tile;
+	
+	if (delay <= 0) {
+		unschedule_tile(tileset, tile_index);
+		return;
+	}
+	tile = &tileset->tiles[tile_index];
+	tile->next_change = tileset->clock + delay;
+	if (tile->schedule_pos < 0) {
+		tile->schedule_pos = tileset->num_scheduled++;
+		tileset->schedule[tile->schedule_pos] = tile_index;
+	}
+	sift_tile_up(tileset, tile->schedule_pos);
+	sift_tile_down(tileset, tile->schedule_pos);
+}
+
+static void
+unschedule_tile(tileset_t* tileset, int tile_index)
+{
+	int heap_pos;
+	int last_index;
+	
+	if ((heap_pos = tileset->tiles[tile_index].schedule_pos) < 0)
+		return;
+	tileset->tiles[tile_index].schedule_pos = -1;
+	last_index = tileset->schedule[--tileset->num_scheduled];
+	if (heap_pos == tileset->num_scheduled)
+		return;
+	tileset->schedule[heap_pos] = last_index;
+	tileset->tiles[last_index].schedule_pos = heap_pos;
+	sift_tile_up(tileset, heap_pos);
+	sift_tile_down(tileset, tileset->tiles[last_index].schedule_pos);
+}
+
+static void
+sift_tile_down(tileset_t* tileset, int heap_pos)
+{
+	int  child_pos;
+	int* heap = tileset->schedule;
+	int  tile_index;
+
+	tile_index = heap[heap_pos];
+	while ((child_pos = heap_pos * 2 + 1) < tileset->num_scheduled) {
+		if (child_pos + 1 < tileset->num_scheduled
+			&& (int)(tileset->tiles[heap[child_pos + 1]].next_change - tileset->tiles[heap[child_pos]].next_change) < 0)
+		{
+			++child_pos;
+		}
+		if ((int)(tileset->tiles[heap[child_pos]].next_change - tileset->tiles[tile_index].next_change) >= 0)
+			break;
+		heap[heap_pos] = heap[child_pos];
+		tileset->tiles[heap[heap_pos]].schedule_pos = heap_pos;
+		heap_pos = child_pos;
+	}
+	heap[heap_pos] = tile_index;
+	tileset->tiles[tile_index].schedule_pos = heap_pos;
+}
+
+static void
+sift_tile_up(tileset_t* tileset, int heap_pos)
+{
+	int* heap = tileset->schedule;
+	int  parent_pos;
+	int  tile_index;
+
+	tile_index = heap[heap_pos];
+	while (heap_pos > 0) {
+		parent_pos = (heap_pos - 1) / 2;
+		if ((int)(tileset->tiles[heap[parent_pos]].next_change - tileset->tiles[tile_index].next_change) <= 0)
+			break;
+		heap[heap_pos] = heap[parent_pos];
+		tileset->tiles[heap[heap_pos]].schedule_pos = heap_pos;
+		heap_pos = parent_pos;
+	}
+	heap[heap_pos] = tile_index;
+	tileset->tiles[tile_index].schedule_pos = heap_pos;
+}
+
+static void
+draw_mask_line(uint64_t* mask, int pitch, int width, int height, rect_t line)
+{
+	// plots a segment into a tile bitmask.  stepping along the longer axis puts at
+	// least one pixel in every row and column the segment crosses, so the edges
+	// test_tile_mask() checks can't slip between them.
+	
+	double dx, dy;
+	int    num_steps;
+	int    x, y;
+
+	int i;
+
+	dx = line.x2 - line.x1;
+	dy = line.y2 - line.y1;
+	num_steps = fmax(fabs(dx), fabs(dy));
+	for (i = 0; i <= num_steps; ++i) {
+		x = floor(line.x1 + (num_steps > 0 ? dx * i / num_steps : 0.0) + 0.5);
+		y = floor(line.y1 + (num_steps > 0 ? dy * i / num_steps : 0.0) + 0.5);
+		if (x < 0 || y < 0 || x >= width || y >= height)
+			continue;
+		mask[y * pitch + x / 64] |= (uint64_t)1 << (x % 64);
+	}
+}
+
+static bool
+test_mask_row(const uint64_t* row, int width, int x1, int x2)
+{
+	uint64_t bits;
+	int      lo, hi;
+
+	int i;
+
+	x1 = x1 > 0 ? x1 : 0;
+	x2 = x2 < width - 1 ? x2 : width - 1;
+	for (i = x1 / 64; i <= x2 / 64; ++i) {
+		lo = i == x1 / 64 ? x1 % 64 : 0;
+		hi = i == x2 / 64 ? x2 % 64 : 63;
+		bits = (~(uint64_t)0 << lo) & (~(uint64_t)0 >> (63 - hi));
+		if (row[i] & bits)
+			return true;
+	}
+	return false;
+}
@@ -2,18 +2,26 @@
 
 typedef struct tileset tileset_t;
 
-tileset_t*       load_tileset    (const char* path);
-tileset_t*       read_tileset    (FILE* file);
-void             free_tileset    (tileset_t* tileset);
-int              get_next_tile   (const tileset_t* tileset, int tile_index);
-int              get_tile_count  (const tileset_t* tileset);
-int              get_tile_delay  (const tileset_t* tileset, int tile_index);
-image_t*         get_tile_image  (const tileset_t* tileset, int tile_index);
-const lstring_t* get_tile_name   (const tileset_t* tileset, int tile_index);
-const obsmap_t*  get_tile_obsmap (const tileset_t* tileset, int tile_index);
-void             get_tile_size   (const tileset_t* tileset, int* out_w, int* out_h);
-void             set_next_tile   (tileset_t* tileset, int tile_index, int next_index);
-void             set_tile_delay  (tileset_t* tileset, int tile_index, int delay);
-void             set_tile_image  (tileset_t* tileset, int tile_index, image_t* image);
-void             animate_tileset (tileset_t* tileset);
-void             draw_tile       (const tileset_t* tileset, color_t mask, float x, float y, int tile_index);
+tileset_t*       load_tileset      (const char* path);
+tileset_t*       read_tileset      (FILE* file);
+tileset_t*       clone_tileset     (const tileset_t* tileset);
+void             free_tileset      (tileset_t* tileset);
+image_t*         get_tile_atlas    (const tileset_t* tileset);
+const int*       get_changed_tiles (const tileset_t* tileset, int* out_count);
+int              get_animated_tile (const tileset_t* tileset, int tile_index);
+int              get_next_tile     (const tileset_t* tileset, int tile_index);
+int              get_tile_count    (const tileset_t* tileset);
+int              get_tile_delay    (const tileset_t* tileset, int tile_index);
+image_t*         get_tile_image    (const tileset_t* tileset, int tile_index);
+const lstring_t* get_tile_name     (const tileset_t* tileset, int tile_index);
+const obsmap_t*  get_tile_obsmap   (const tileset_t* tileset, int tile_index);
+bool             get_tile_uv       (const tileset_t* tileset, int tile_index, int* out_u, int* out_v);
+void             get_tile_size     (const tileset_t* tileset, int* out_w, int* out_h);
+bool             is_tile_animated  (const tileset_t* tileset, int tile_index);
+void             set_next_tile     (tileset_t* tileset, int tile_index, int next_index);
+void             set_tile_delay    (tileset_t* tileset, int tile_index, int delay);
+void             set_tile_image    (tileset_t* tileset, int tile_index, image_t* image);
+bool             test_tile_mask    (const tileset_t* tileset, int tile_index, rect_t rect);
+bool             upload_tileset    (tileset_t* tileset);
+void             animate_tileset   (tileset_t* tileset);
+void             draw_tile         (const tileset_t* tileset, color_t mask, float x, float y, int tile_index);